@@ -43,6 +43,14 @@ static __inline uint64_t read_eflags(void) {
 	return rflags;
 }
 
+/* Reads the time-stamp counter, which counts CPU clock cycles. */
+__attribute__((always_inline))
+static __inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
 __attribute__((always_inline))
 static __inline uint64_t rcr3(void) {
 	uint64_t val;
@@ -50,6 +58,21 @@ static __inline uint64_t rcr3(void) {
 	return val;
 }
 
+/* Control register 4 holds, among others, the PCIDE bit that
+   turns on process-context identifiers.  See [IA32-v3a] 2.5
+   "Control Registers". */
+__attribute__((always_inline))
+static __inline uint64_t rcr4(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr4,%0" : "=r" (val));
+	return val;
+}
+
+__attribute__((always_inline))
+static __inline void lcr4(uint64_t val) {
+	__asm __volatile("movq %0, %%cr4" : : "r" (val) : "memory");
+}
+
 __attribute__((always_inline))
 static __inline uint64_t rrax(void) {
 	uint64_t val;
@@ -36,6 +36,12 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Diagnostics. */
+	SYS_LOCKSTAT,               /* Read the kernel lock profile. */
+
+	/* Virtual memory hints. */
+	SYS_MADVISE,                /* Give a hint about memory use. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -13,6 +13,13 @@ typedef int pid_t;
 typedef int off_t;
 #define MAP_FAILED ((void *) NULL)
 
+/* Hints for madvise(). */
+#define MADV_NORMAL 0           /* No particular pattern. */
+#define MADV_RANDOM 1           /* Random access: no read-ahead. */
+#define MADV_SEQUENTIAL 2       /* Sequential access: read far ahead. */
+#define MADV_WILLNEED 3         /* Will be used soon: read it in now. */
+#define MADV_DONTNEED 4         /* Not needed: free it. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -38,9 +45,13 @@ void close (int fd);
 
 int dup2(int oldfd, int newfd);
 
+/* Diagnostics. */
+int lockstat (char *buffer, unsigned size);
+
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
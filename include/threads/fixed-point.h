@@ -0,0 +1,46 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic, used by the MLFQS scheduler.
+ *
+ * A real number X is stored as the int X * FP_ONE, which leaves
+ * 17 bits for the integer part and 14 bits for the fraction.
+ * Products and quotients of two fixed-point numbers go through
+ * 64 bits so the intermediate value does not overflow. */
+typedef int fixed_t;
+
+#define FP_SHIFT 14
+#define FP_ONE (1 << FP_SHIFT)
+
+/* Converts integer N to fixed point. */
+static inline fixed_t fp_from_int (int n) { return n * FP_ONE; }
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int fp_to_int (fixed_t x) { return x / FP_ONE; }
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+fp_round (fixed_t x) {
+	return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+static inline fixed_t fp_add (fixed_t x, fixed_t y) { return x + y; }
+static inline fixed_t fp_sub (fixed_t x, fixed_t y) { return x - y; }
+static inline fixed_t fp_add_int (fixed_t x, int n) { return x + n * FP_ONE; }
+static inline fixed_t fp_sub_int (fixed_t x, int n) { return x - n * FP_ONE; }
+static inline fixed_t fp_mul_int (fixed_t x, int n) { return x * n; }
+static inline fixed_t fp_div_int (fixed_t x, int n) { return x / n; }
+
+static inline fixed_t
+fp_mul (fixed_t x, fixed_t y) {
+	return ((int64_t) x) * y / FP_ONE;
+}
+
+static inline fixed_t
+fp_div (fixed_t x, fixed_t y) {
+	return ((int64_t) x) * FP_ONE / y;
+}
+
+#endif /* threads/fixed-point.h */
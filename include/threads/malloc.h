@@ -8,6 +8,7 @@ void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
+void *malloc_copy (void *);
 void free (void *);
 
 #endif /* threads/malloc.h */
@@ -3,6 +3,9 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
 
 /* A counting semaphore. */
 struct semaphore {
@@ -20,6 +23,12 @@ void sema_self_test (void);
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+
+#ifdef LOCK_PROFILE
+	struct lock_class *class;   /* Profile, or NULL if none was free. */
+	struct lock_site *site;     /* Where the holder got it, or NULL. */
+	uint64_t acquired_at;       /* TSC value when the holder got it. */
+#endif
 };
 
 void lock_init (struct lock *);
@@ -27,6 +36,43 @@ void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
+int lock_stats_read (char *, size_t);
+
+/* Spin lock. */
+struct spinlock {
+	int locked;                 /* Nonzero while held. */
+	enum intr_level old_level;  /* Holder's interrupt level to restore. */
+};
+
+void spin_init (struct spinlock *);
+void spin_lock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+
+/* Readers-writer lock.  Any number of readers or a single
+   writer may hold it.  A waiting writer keeps new readers out,
+   and every waiter donates its priority to all current holders. */
+struct rwlock {
+	int readers;                /* # of threads holding it for reading. */
+	struct thread *writer;      /* Thread holding it for writing, or NULL. */
+	struct list holds;          /* Current holders' struct rw_hold. */
+	struct list read_waiters;   /* Threads waiting to read. */
+	struct list write_waiters;  /* Threads waiting to write. */
+};
+
+/* One rwlock held by a thread.  Embedded in struct thread so that
+   a waiter can find and donate to every holder. */
+struct rw_hold {
+	struct rwlock *rwlock;      /* Held rwlock, or NULL if slot is free. */
+	struct thread *thread;      /* Holding thread. */
+	struct list_elem elem;      /* Element in rwlock's holds list. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_read_acquire (struct rwlock *);
+void rwlock_read_release (struct rwlock *);
+void rwlock_write_acquire (struct rwlock *);
+void rwlock_write_release (struct rwlock *);
 
 /* Condition variable. */
 struct condition {
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h" 
 #ifdef VM
@@ -29,6 +30,19 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* The ready queue keeps one bit per priority level in a 64-bit mask. */
+#if PRI_MAX - PRI_MIN + 1 > 64
+#error ready queue supports at most 64 priority levels
+#endif
+
+/* Number of slots in per-CPU arrays, indexed by cpu_id().  Only
+   the bootstrap processor is started, so there is one. */
+#define CPU_MAX 1
+
+/* Number of rwlocks a thread can hold at once and still receive
+   donations through them.  Holds beyond this still work. */
+#define RW_HOLD_MAX 4
+
 #define FDT_COUNT_LIMIT 128    			/* FD 값 한계 */
 #define FDT_PAGES 2
 
@@ -95,6 +109,9 @@ struct thread {
 	enum thread_status status;          /* Thread state. */
 	char name[16];                      /* Name (for debugging purposes). */
 	int priority;                       /* Priority. */
+	int nice;                           /* MLFQS niceness. */
+	fixed_t recent_cpu;                 /* MLFQS recent CPU time. */
+	struct list_elem allelem;           /* List element for all threads list. */
 	int64_t wakeup_tick;
 	uint8_t *stack; 				// Stack Pointer 저장
 	/* Shared between thread.c and synch.c. */
@@ -105,6 +122,8 @@ struct thread {
 	struct lock *wait_on_lock;  	// 요청한 lock
 	struct list donations;			// 기부 받은 우선순위 리스트
 	struct list_elem donation_elem; // donations 식별자
+	struct rwlock *wait_on_rwlock;      /* rwlock we are waiting on. */
+	struct rw_hold rw_holds[RW_HOLD_MAX]; /* rwlocks we hold. */
 	struct list child_list;             /* 자식 프로세스를 담아줄 리스트*/
 	struct list_elem child_elem;		/* child_list에 담아줄 elem */ 
 	struct semaphore fork_sema;          /* 자식 프로세스를 정상적으로 로드하기 위해, 부모 프로세스가 sema_down/up하게 되는 세마포어 */ //fork가 완료될때 까지 부모가 기다리게 하는 forksema
@@ -123,6 +142,7 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	void *user_rsp;                     /* User rsp at system call entry. */
 #endif
 
 	/* Owned by thread.c. */
@@ -143,6 +163,9 @@ void thread_start (void);
 void thread_tick (void);
 void thread_print_stats (void);
 
+int cpu_count (void);
+int cpu_id (void);
+
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
@@ -160,6 +183,8 @@ void thread_awake (int64_t ticks);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *, int priority);
+void thread_test_preemption (void);
 bool cmp_thread_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
 
 int thread_get_nice (void);
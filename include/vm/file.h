@@ -1,17 +1,45 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
 struct page;
 enum vm_type;
+struct supplemental_page_table;
 
+/* A region of a process's address space mapped by mmap().  Its
+   pages are VM_FILE pages whose file_page points back here; they
+   are written back to FILE, a reopened handle of the process's
+   own, when dirty.  Regions are kept in the process's
+   supplemental page table. */
+struct mmap_region {
+	struct list_elem elem;      /* In supplemental_page_table.mmaps. */
+	void *addr;                 /* First page. */
+	size_t page_cnt;            /* Number of pages. */
+	struct file *file;          /* File mapped. */
+	off_t offset;               /* Offset of ADDR in FILE. */
+	int advice;                 /* MADV_NORMAL, _RANDOM or _SEQUENTIAL. */
+};
+
+/* Where a file-backed page's contents come from.  The aux of a
+   VM_FILE page created with file_backed_load() as its initializer
+   is a malloc'd copy of this, which the page takes over. */
 struct file_page {
+	struct inode *inode;        /* Inode to read from. */
+	off_t offset;               /* Offset of the page in it. */
+	size_t read_bytes;          /* Bytes to read; the rest is zero. */
+	struct mmap_region *region; /* Mapping, or null for program text. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_backed_load (struct page *page, void *aux);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+struct mmap_region *mmap_find (struct supplemental_page_table *spt,
+		const void *va);
+bool mmap_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
 #endif
@@ -2,6 +2,7 @@
 
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <list.h>
 #include <stdbool.h>
 
 #include "hash.h"
@@ -28,6 +29,24 @@ enum vm_type {
     VM_MARKER_END = (1 << 31),
 };
 
+/* Marks an anonymous page of the user stack, the only kind of page
+ * allowed in the stack's region (see vm_stack_growth()). */
+#define VM_STACK VM_MARKER_0
+
+/* Marks an anonymous page whose contents are loaded from the
+ * executable, that is, initialized data. */
+#define VM_SEGMENT VM_MARKER_1
+
+/* Hints given by madvise(), with the values of the MADV_*
+ * constants in <syscall.h>.  The first three are kept in a
+ * mapping (see struct mmap_region); the others are acted on at
+ * once. */
+#define MADV_NORMAL 0     /* No particular pattern. */
+#define MADV_RANDOM 1     /* Random access: no fault-around. */
+#define MADV_SEQUENTIAL 2 /* Sequential access: read far ahead, drop behind. */
+#define MADV_WILLNEED 3   /* Read the pages in now. */
+#define MADV_DONTNEED 4   /* Free the anonymous pages' memory. */
+
 #include "vm/anon.h"
 #include "vm/file.h"
 #include "vm/uninit.h"
@@ -52,6 +71,9 @@ struct page {
     // REVIEW hash_elem 선언
     struct hash_elem hash_elem;
     bool writable;
+    uint64_t *pml4; /* Page map that maps va while in a frame. */
+    struct supplemental_page_table *spt; /* Table the page is in. */
+    struct page *share_next; /* Next page sharing frame, in a ring. */
     /* Per-type data are binded into the union.
      * Each function automatically detects the current union */
     union {
@@ -64,13 +86,29 @@ struct page {
     };
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".  There is one for every page of
+ * the user pool, kept in an array in address order (see
+ * vm_frame_of()); the frame is in use while PAGE is set.
+ *
+ * After a fork, pages of several processes may share one frame
+ * read-only (copy-on-write); they form a ring through
+ * page->share_next, which leads to every page map that maps the
+ * frame.  PAGE is any one of them and REF_CNT is how many there
+ * are.  A pinned frame is not evicted: it is being loaded. */
 struct frame {
     void *kva;
     struct page *page;
-    struct list_elem *frame_elem;
+    unsigned ref_cnt;
+    unsigned short pin_cnt;
+    uint8_t flags;       /* FRAME_* bits the clock last saw. */
 };
 
+/* Snapshots of the accessed and dirty bits of a frame's mapping,
+ * taken by the clock. */
+#define FRAME_REF 0x1   /* Accessed since the clock last came by. */
+#define FRAME_DIRTY 0x2 /* Written since it was loaded. */
+#define FRAME_TEXT 0x4  /* In the shared text cache (vm.c). */
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -91,9 +129,17 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
-    struct hash *hash_page;
+    struct hash hash_page;
+    void *around_next;   /* Where a sequential scan faults next. */
+    unsigned around_win; /* Pages to map past a fault there. */
+    void *huge_miss;     /* Last 2 MB region found unfit for a huge page. */
+    void *stack_bottom;  /* Lowest page of the user stack so far. */
+    struct list mmaps;   /* Mapped regions (struct mmap_region). */
 };
 
+/* Most pages the user stack may grow to. */
+extern size_t stack_page_limit;
+
 #include "threads/thread.h"
 void supplemental_page_table_init(struct supplemental_page_table *spt);
 bool supplemental_page_table_copy(struct supplemental_page_table *dst,
@@ -113,7 +159,14 @@ bool vm_try_handle_fault(struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer(enum vm_type type, void *upage,
                                     bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page(struct page *page);
+void vm_free_frame(struct page *page);
+bool vm_pin_frame(struct page *page);
+void vm_unpin_frame(struct page *page);
+struct frame *vm_frame_of(const void *kva);
+void vm_print_stats(void);
 bool vm_claim_page(void *va);
+bool vm_claim_stack(void *addr);
+int do_madvise(void *addr, size_t length, int advice);
 enum vm_type page_get_type(struct page *page);
 
 #endif /* VM_VM_H */
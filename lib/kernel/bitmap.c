@@ -62,6 +62,65 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a mask of the bits of element ELEM_IDX that fall in the
+   bit range [START, END). */
+static inline elem_type
+range_mask (size_t elem_idx, size_t start, size_t end) {
+	size_t first = elem_idx * ELEM_BITS;
+	elem_type mask = (elem_type) -1;
+
+	if (start > first)
+		mask <<= start - first;
+	if (end < first + ELEM_BITS)
+		mask &= ((elem_type) 1 << (end - first)) - 1;
+	return mask;
+}
+
+/* Returns an element whose bits are set where those of E equal
+   VALUE. */
+static inline elem_type
+match (elem_type e, bool value) {
+	return value ? e : ~e;
+}
+
+/* Returns the number of 1-bits in E.  Written out rather than
+   using __builtin_popcountl(), which without -mpopcnt becomes a
+   call into libgcc, which the kernel does not link. */
+static inline unsigned
+popcount (elem_type e) {
+	e = e - ((e >> 1) & 0x5555555555555555UL);
+	e = (e & 0x3333333333333333UL) + ((e >> 2) & 0x3333333333333333UL);
+	e = (e + (e >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (e * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's size if there is none.  Skips whole
+   elements that have no such bit and finds the bit within an
+   element with a count-trailing-zeros instruction. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	size_t idx, last_idx, bit;
+	elem_type e;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	idx = elem_idx (start);
+	last_idx = elem_cnt (b->bit_cnt) - 1;
+	e = match (b->bits[idx], value) & range_mask (idx, start, b->bit_cnt);
+	while (e == 0) {
+		if (idx == last_idx)
+			return b->bit_cnt;
+		idx++;
+		e = match (b->bits[idx], value);
+	}
+
+	/* Bits past the end of the last element are undefined. */
+	bit = idx * ELEM_BITS + __builtin_ctzl (e);
+	return bit < b->bit_cnt ? bit : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -194,33 +253,44 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Each
+   element is updated atomically, as with bitmap_set(). */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
+	size_t idx;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	if (cnt == 0)
+		return;
+	for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++) {
+		elem_type mask = range_mask (idx, start, end);
+		if (value)
+			asm ("lock orq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "+m" (b->bits[idx]) : "r" (~mask) : "cc");
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t idx, value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	if (cnt > 0)
+		for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+			value_cnt += popcount (match (b->bits[idx], value)
+					& range_mask (idx, start, end));
 	return value_cnt;
 }
 
@@ -228,15 +298,17 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
+	size_t idx;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
+	if (cnt > 0)
+		for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+			if (match (b->bits[idx], value) & range_mask (idx, start, end))
+				return true;
 	return false;
 }
 
@@ -266,7 +338,11 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Walks the bitmap run by run: finds the next bit set to VALUE,
+   then the end of its run, and moves on past the run if it is
+   too short, so each element is looked at about once. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
@@ -274,10 +350,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 
 	if (cnt <= b->bit_cnt) {
 		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+		size_t i = start;
+
+		if (cnt == 0)
+			return start <= last ? start : BITMAP_ERROR;
+		while (i <= last) {
+			size_t run_start = find_next (b, i, value);
+			size_t run_end;
+
+			if (run_start > last)
+				break;
+			run_end = find_next (b, run_start, !value);
+			if (run_end - run_start >= cnt)
+				return run_start;
+			i = run_end;
+		}
 	}
 	return BITMAP_ERROR;
 }
@@ -0,0 +1,190 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_count(), bitmap_contains(), bitmap_scan() and
+   bitmap_set_multiple() against straightforward bit-at-a-time
+   versions, like the ones they replaced, on random bitmaps, then
+   times both on a large, fragmented bitmap.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "intrinsic.h"
+#include "threads/test.h"
+
+/* Maximum size of bitmap that we will check. */
+#define MAX_BITS 300
+
+/* Size of bitmap that we time, and number of runs. */
+#define BENCH_BITS 16384
+#define BENCH_RUNS 16
+
+static size_t ref_count (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static bool ref_contains (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static size_t ref_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool value);
+static void fill_random (struct bitmap *, int density);
+static void check (void);
+static void bench (void);
+
+/* Tests and times the bitmap implementation. */
+void
+test (void) 
+{
+  check ();
+  bench ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Compares the bitmap functions against the reference versions
+   on many random bitmaps and ranges. */
+static void
+check (void) 
+{
+  int iter;
+
+  printf ("checking against bit-at-a-time versions...");
+  for (iter = 0; iter < 20000; iter++) 
+    {
+      size_t bit_cnt = random_ulong () % MAX_BITS;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      size_t start, cnt, run, i;
+      bool value;
+
+      ASSERT (b != NULL);
+      fill_random (b, iter % 7 + 1);
+      start = random_ulong () % (bit_cnt + 1);
+      cnt = random_ulong () % (bit_cnt - start + 1);
+      run = random_ulong () % 8;
+      value = random_ulong () % 2;
+
+      ASSERT (bitmap_count (b, start, cnt, value)
+              == ref_count (b, start, cnt, value));
+      ASSERT (bitmap_contains (b, start, cnt, value)
+              == ref_contains (b, start, cnt, value));
+      ASSERT (bitmap_scan (b, start, run, value)
+              == ref_scan (b, start, run, value));
+
+      bitmap_set_multiple (b, start, cnt, value);
+      for (i = 0; i < cnt; i++)
+        ASSERT (bitmap_test (b, start + i) == value);
+
+      bitmap_destroy (b);
+    }
+  printf (" done\n");
+}
+
+/* Times scanning for runs of free bits and counting them, with
+   the library and with the reference versions, in TSC ticks. */
+static void
+bench (void) 
+{
+  static const size_t runs[] = { 1, 2, 8, 64 };
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  size_t i;
+
+  ASSERT (b != NULL);
+
+  /* Mostly used, with scattered short free runs, like a busy
+     page pool. */
+  fill_random (b, 1);
+  for (i = 0; i < BENCH_BITS; i++)
+    if (random_ulong () % 16 != 0)
+      bitmap_mark (b, i);
+  bitmap_set_multiple (b, BENCH_BITS - 100, 100, false);
+
+  for (i = 0; i < sizeof runs / sizeof *runs; i++) 
+    {
+      uint64_t t0, t1, t2;
+      size_t fast = 0, ref = 0;
+      int r;
+
+      t0 = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        fast = bitmap_scan (b, 0, runs[i], false);
+      t1 = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        ref = ref_scan (b, 0, runs[i], false);
+      t2 = rdtsc ();
+      ASSERT (fast == ref);
+      printf ("scan for %2zu free: %10llu ticks, bit-at-a-time %10llu\n",
+              runs[i], (unsigned long long) (t1 - t0) / BENCH_RUNS,
+              (unsigned long long) (t2 - t1) / BENCH_RUNS);
+    }
+
+  {
+    uint64_t t0, t1, t2;
+    size_t fast = 0, ref = 0;
+    int r;
+
+    t0 = rdtsc ();
+    for (r = 0; r < BENCH_RUNS; r++)
+      fast = bitmap_count (b, 0, BENCH_BITS, false);
+    t1 = rdtsc ();
+    for (r = 0; r < BENCH_RUNS; r++)
+      ref = ref_count (b, 0, BENCH_BITS, false);
+    t2 = rdtsc ();
+    ASSERT (fast == ref);
+    printf ("count:            %10llu ticks, bit-at-a-time %10llu\n",
+            (unsigned long long) (t1 - t0) / BENCH_RUNS,
+            (unsigned long long) (t2 - t1) / BENCH_RUNS);
+  }
+
+  bitmap_destroy (b);
+}
+
+/* Sets about one bit in DENSITY of B to true, the rest to false. */
+static void
+fill_random (struct bitmap *b, int density) 
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, random_ulong () % density == 0);
+}
+
+/* Bit-at-a-time bitmap_count(). */
+static size_t
+ref_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Bit-at-a-time bitmap_contains(). */
+static bool
+ref_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/* Bit-at-a-time bitmap_scan(). */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  if (cnt <= bitmap_size (b)) 
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!ref_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
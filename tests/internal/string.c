@@ -0,0 +1,205 @@
+/* Test program and microbenchmark for memcpy(), memset(),
+   memcmp() and strlen() in lib/string.c.
+
+   Checks each function against a byte-at-a-time version for
+   every combination of source and destination alignment within
+   a word and many sizes, then times both for a few sizes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "intrinsic.h"
+#include "threads/test.h"
+
+/* Largest size checked, and buffer size with room for offsets
+   and guard bytes. */
+#define MAX_SIZE 600
+#define BUF_SIZE (MAX_SIZE + 64)
+
+/* Number of timing runs per size. */
+#define BENCH_RUNS 64
+
+static unsigned char src[BUF_SIZE], dst[BUF_SIZE], ref[BUF_SIZE];
+
+static void ref_memcpy (void *, const void *, size_t);
+static void ref_memset (void *, int, size_t);
+static int ref_memcmp (const void *, const void *, size_t);
+static size_t ref_strlen (const char *);
+static void check (void);
+static void bench (void);
+
+/* Tests and times the string functions. */
+void
+test (void) 
+{
+  check ();
+  bench ();
+  printf ("string: PASS\n");
+}
+
+/* Returns the sign of X. */
+static int
+sign (int x) 
+{
+  return x > 0 ? 1 : x < 0 ? -1 : 0;
+}
+
+/* Checks every alignment of source and destination within a
+   word, for sizes around the word and REP thresholds. */
+static void
+check (void) 
+{
+  int s_ofs, d_ofs;
+  size_t size;
+
+  printf ("checking all alignments...");
+  for (s_ofs = 0; s_ofs < 8; s_ofs++)
+    for (d_ofs = 0; d_ofs < 8; d_ofs++)
+      for (size = 0; size <= MAX_SIZE; size += size < 40 ? 1 : 37) 
+        {
+          size_t i;
+
+          random_bytes (src, sizeof src);
+          random_bytes (dst, sizeof dst);
+          memcpy (ref, dst, sizeof ref);
+
+          /* memcpy() must copy exactly SIZE bytes. */
+          memcpy (dst + d_ofs, src + s_ofs, size);
+          ref_memcpy (ref + d_ofs, src + s_ofs, size);
+          ASSERT (ref_memcmp (dst, ref, sizeof dst) == 0);
+
+          /* memset() likewise. */
+          memset (dst + d_ofs, s_ofs * 31, size);
+          ref_memset (ref + d_ofs, s_ofs * 31, size);
+          ASSERT (ref_memcmp (dst, ref, sizeof dst) == 0);
+
+          /* memcmp() must find a difference in any position. */
+          ref_memcpy (dst, src, sizeof dst);
+          ASSERT (memcmp (dst + d_ofs, src + d_ofs, size) == 0);
+          for (i = 0; i < size; i += size / 5 + 1) 
+            {
+              dst[d_ofs + i] ^= 1 << s_ofs;
+              ASSERT (sign (memcmp (dst + d_ofs, src + d_ofs, size))
+                      == sign (ref_memcmp (dst + d_ofs, src + d_ofs, size)));
+              dst[d_ofs + i] ^= 1 << s_ofs;
+            }
+
+          /* strlen() must stop at the first null. */
+          ref_memset (dst, 'x', sizeof dst);
+          dst[d_ofs + size] = '\0';
+          ASSERT (strlen ((char *) dst + d_ofs) == size);
+          ASSERT (ref_strlen ((char *) dst + d_ofs) == size);
+        }
+  printf (" done\n");
+}
+
+/* Times the library and reference versions, in TSC ticks. */
+static void
+bench (void) 
+{
+  static const size_t sizes[] = { 8, 64, 512, 4096 };
+  static unsigned char big_src[4096], big_dst[4096];
+  size_t i;
+
+  printf ("%6s %18s %18s %18s %18s\n", "size",
+          "memcpy/ref", "memset/ref", "memcmp/ref", "strlen/ref");
+  ref_memset (big_src, 'x', sizeof big_src);
+  ref_memset (big_dst, 'x', sizeof big_dst);
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++) 
+    {
+      size_t size = sizes[i];
+      uint64_t t[9];
+      int r;
+
+      big_src[size - 1] = '\0';
+      t[0] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        memcpy (big_dst, big_src, size);
+      t[1] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        ref_memcpy (big_dst, big_src, size);
+      t[2] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        memset (big_dst, 0, size);
+      t[3] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        ref_memset (big_dst, 0, size);
+      t[4] = rdtsc ();
+      ref_memcpy (big_dst, big_src, size);
+      for (r = 0; r < BENCH_RUNS; r++)
+        ASSERT (memcmp (big_dst, big_src, size) == 0);
+      t[5] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        ASSERT (ref_memcmp (big_dst, big_src, size) == 0);
+      t[6] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        ASSERT (strlen ((char *) big_src) == size - 1);
+      t[7] = rdtsc ();
+      for (r = 0; r < BENCH_RUNS; r++)
+        ASSERT (ref_strlen ((char *) big_src) == size - 1);
+      t[8] = rdtsc ();
+      big_src[size - 1] = 'x';
+
+      printf ("%6zu %8llu/%-9llu %8llu/%-9llu %8llu/%-9llu %8llu/%-9llu\n",
+              size,
+              (unsigned long long) (t[1] - t[0]) / BENCH_RUNS,
+              (unsigned long long) (t[2] - t[1]) / BENCH_RUNS,
+              (unsigned long long) (t[3] - t[2]) / BENCH_RUNS,
+              (unsigned long long) (t[4] - t[3]) / BENCH_RUNS,
+              (unsigned long long) (t[5] - t[4]) / BENCH_RUNS,
+              (unsigned long long) (t[6] - t[5]) / BENCH_RUNS,
+              (unsigned long long) (t[7] - t[6]) / BENCH_RUNS,
+              (unsigned long long) (t[8] - t[7]) / BENCH_RUNS);
+    }
+}
+
+/* Byte-at-a-time memcpy(). */
+static void
+ref_memcpy (void *dst_, const void *src_, size_t size) 
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+/* Byte-at-a-time memset(). */
+static void
+ref_memset (void *dst_, int value, size_t size) 
+{
+  unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+/* Byte-at-a-time memcmp(). */
+static int
+ref_memcmp (const void *a_, const void *b_, size_t size) 
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+/* Byte-at-a-time strlen(). */
+static size_t
+ref_strlen (const char *string) 
+{
+  const char *p;
+
+  for (p = string; *p != '\0'; p++)
+    continue;
+  return p - string;
+}
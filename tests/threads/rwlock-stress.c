@@ -0,0 +1,151 @@
+/* Exercises readers-writer locks.
+
+   First, the main thread holds an rwlock for reading while other
+   threads arrive: a reader that should get in at once, a writer
+   that must wait and donate its priority to the main thread, and
+   a later reader that must queue behind the waiting writer and
+   donate its priority as well.
+
+   Then a crowd of readers and writers hammer a single rwlock,
+   yielding inside their critical sections.  Writers update an
+   array one element at a time, so a reader that ever overlaps a
+   writer sees the elements disagree. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_func;
+static thread_func writer_func;
+static thread_func late_reader_func;
+static thread_func stress_reader_func;
+static thread_func stress_writer_func;
+
+#define READER_CNT 6
+#define WRITER_CNT 3
+#define ITER_CNT 50
+#define DATA_CNT 8
+
+static struct rwlock rw;
+static struct semaphore done;
+static int data[DATA_CNT];
+static int readers_in;
+static int writers_in;
+static int write_cnt;
+
+void
+test_rwlock_stress (void)
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+  rwlock_read_acquire (&rw);
+  thread_create ("reader", PRI_DEFAULT + 5, reader_func, NULL);
+  thread_create ("writer", PRI_DEFAULT + 10, writer_func, NULL);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 10, thread_get_priority ());
+  thread_create ("late-reader", PRI_DEFAULT + 15, late_reader_func, NULL);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 15, thread_get_priority ());
+  rwlock_read_release (&rw);
+  msg ("writer, late-reader must already have finished.");
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+
+  sema_init (&done, 0);
+  for (i = 0; i < READER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT, stress_reader_func, NULL);
+    }
+  for (i = 0; i < WRITER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "writer %d", i);
+      thread_create (name, PRI_DEFAULT, stress_writer_func, NULL);
+    }
+  for (i = 0; i < READER_CNT + WRITER_CNT; i++)
+    sema_down (&done);
+  msg ("%d writes completed.", write_cnt);
+}
+
+static void
+reader_func (void *aux UNUSED)
+{
+  rwlock_read_acquire (&rw);
+  msg ("reader: got the lock alongside the main thread");
+  rwlock_read_release (&rw);
+}
+
+static void
+writer_func (void *aux UNUSED)
+{
+  rwlock_write_acquire (&rw);
+  msg ("writer: got the lock with priority %d", thread_get_priority ());
+  rwlock_write_release (&rw);
+  msg ("writer: done");
+}
+
+static void
+late_reader_func (void *aux UNUSED)
+{
+  rwlock_read_acquire (&rw);
+  msg ("late-reader: got the lock");
+  rwlock_read_release (&rw);
+  msg ("late-reader: done");
+}
+
+static void
+stress_reader_func (void *aux UNUSED)
+{
+  int i, j;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      rwlock_read_acquire (&rw);
+      readers_in++;
+      if (writers_in != 0)
+        fail ("%s: reading while a writer holds the lock",
+              thread_name ());
+      thread_yield ();
+      for (j = 1; j < DATA_CNT; j++)
+        if (data[j] != data[0])
+          fail ("%s: saw a half-finished write", thread_name ());
+      readers_in--;
+      rwlock_read_release (&rw);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
+
+static void
+stress_writer_func (void *aux UNUSED)
+{
+  int i, j;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      rwlock_write_acquire (&rw);
+      if (writers_in++ != 0 || readers_in != 0)
+        fail ("%s: writing while others hold the lock", thread_name ());
+      for (j = 0; j < DATA_CNT; j++)
+        {
+          data[j]++;
+          thread_yield ();
+        }
+      write_cnt++;
+      writers_in--;
+      rwlock_write_release (&rw);
+      thread_yield ();
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-stress) begin
+(rwlock-stress) reader: got the lock alongside the main thread
+(rwlock-stress) This thread should have priority 41.  Actual priority: 41.
+(rwlock-stress) This thread should have priority 46.  Actual priority: 46.
+(rwlock-stress) writer: got the lock with priority 46
+(rwlock-stress) late-reader: got the lock
+(rwlock-stress) late-reader: done
+(rwlock-stress) writer: done
+(rwlock-stress) writer, late-reader must already have finished.
+(rwlock-stress) This thread should have priority 31.  Actual priority: 31.
+(rwlock-stress) 150 writes completed.
+(rwlock-stress) end
+EOF
+pass;
@@ -0,0 +1,101 @@
+/* Measures the throughput of CPU-bound kernel threads.  A fixed
+   amount of work is done first by a single thread and then split
+   evenly across two threads per CPU; the ratio of the two run
+   times is reported as the speedup.  Only the bootstrap processor
+   runs threads, so the speedup stays close to 1 and what this
+   shows is the cost of time slicing between the workers; it says
+   nothing about load balancing.
+
+   This is a benchmark: it only fails if the work does not get
+   done. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define WORK_UNITS 256          /* Units of work per run. */
+#define UNIT_LOOPS 50000        /* Busy-loop iterations per unit. */
+#define MAX_THREADS (2 * CPU_MAX)
+
+struct worker
+  {
+    int units;                  /* Units of work to do. */
+    int done;                   /* Units of work done. */
+    struct semaphore *finished; /* Upped when all units are done. */
+  };
+
+static thread_func worker_func;
+static int64_t run_workers (int thread_cnt);
+
+void
+test_sched_throughput (void) 
+{
+  int thread_cnt = 2 * cpu_count ();
+  int64_t serial, parallel;
+
+  if (thread_cnt > MAX_THREADS)
+    thread_cnt = MAX_THREADS;
+
+  msg ("Running %d units of work on %d CPU(s).", WORK_UNITS, cpu_count ());
+
+  serial = run_workers (1);
+  parallel = run_workers (thread_cnt);
+  if (parallel == 0)
+    parallel = 1;
+
+  msg ("1 thread: %lld ticks.", serial);
+  msg ("%d threads: %lld ticks.", thread_cnt, parallel);
+  msg ("Speedup: %lld.%02lld.", serial / parallel, serial * 100 / parallel % 100);
+  pass ();
+}
+
+/* Splits WORK_UNITS units of work across THREAD_CNT threads at
+   the default priority, waits for all of them to finish, and
+   returns the number of timer ticks that took. */
+static int64_t
+run_workers (int thread_cnt) 
+{
+  struct worker workers[MAX_THREADS];
+  struct semaphore finished;
+  int64_t start;
+  int i;
+
+  ASSERT (thread_cnt > 0 && thread_cnt <= MAX_THREADS);
+
+  sema_init (&finished, 0);
+  start = timer_ticks ();
+  for (i = 0; i < thread_cnt; i++) 
+    {
+      struct worker *w = &workers[i];
+      char name[16];
+
+      w->units = WORK_UNITS / thread_cnt + (i < WORK_UNITS % thread_cnt);
+      w->done = 0;
+      w->finished = &finished;
+      snprintf (name, sizeof name, "worker %d", i);
+      thread_create (name, PRI_DEFAULT, worker_func, w);
+    }
+  for (i = 0; i < thread_cnt; i++)
+    sema_down (&finished);
+
+  for (i = 0; i < thread_cnt; i++)
+    if (workers[i].done != workers[i].units)
+      fail ("worker %d did %d of %d units", i, workers[i].done,
+            workers[i].units);
+  return timer_elapsed (start);
+}
+
+static void
+worker_func (void *w_) 
+{
+  struct worker *w = w_;
+  int i;
+
+  for (w->done = 0; w->done < w->units; w->done++)
+    for (i = 0; i < UNIT_LOOPS; i++)
+      barrier ();
+  sema_up (w->finished);
+}
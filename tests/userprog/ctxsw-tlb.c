@@ -0,0 +1,63 @@
+/* Measures how much of a process's TLB working set survives a
+   switch to another process and back.  Each round, the parent
+   forks a child that exits at once, waits for it, and then reads
+   one byte from each of WS_PAGES pages twice, timing each pass.
+   If switching address spaces flushes the TLB, the first pass
+   takes a TLB miss per page and the second none; with tagged TLB
+   entries, both passes should cost about the same.
+
+   This is a benchmark: it only fails if fork or wait does. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define WS_PAGES 64             /* Pages in the working set. */
+#define ROUNDS 32               /* Fork/wait round trips. */
+#define PAGE_SIZE 4096
+
+static char buf[WS_PAGES * PAGE_SIZE];
+
+/* Reads a byte from each page of BUF and returns the number of
+   cycles that took. */
+static uint64_t
+read_pass (void)
+{
+  volatile char *p = buf;
+  uint64_t start = rdtsc ();
+  int i;
+
+  for (i = 0; i < WS_PAGES; i++)
+    (void) p[i * PAGE_SIZE];
+  return rdtsc () - start;
+}
+
+void
+test_main (void)
+{
+  uint64_t cold = 0, warm = 0;
+  int i;
+
+  /* Fault the working set in.  The first fork leaves it mapped
+     read-only, and since we only read it from then on, later
+     forks do not have to change its mappings. */
+  for (i = 0; i < WS_PAGES; i++)
+    buf[i * PAGE_SIZE] = 1;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      int pid = fork ("child");
+      if (pid == 0)
+        exit (0);
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("wait for child %d failed", pid);
+      cold += read_pass ();
+      warm += read_pass ();
+    }
+
+  msg ("%d pages: %llu cycles per pass after a switch, %llu after a pass",
+       WS_PAGES, cold / ROUNDS, warm / ROUNDS);
+}
@@ -0,0 +1,90 @@
+/* Gives each madvise() hint and checks that none of them changes
+   what memory reads as, except that MADV_DONTNEED frees anonymous
+   memory, which then reads as zeros.  Initialized data survives
+   MADV_DONTNEED.  Invalid hints fail. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define PAGE_SIZE 4096
+#define CHUNK 4096
+
+static char buf[CHUNK];
+static char anon[2 * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static char data[] = "initialized data";
+
+/* Sums every byte of the file open as HANDLE with read(). */
+static unsigned
+sum_by_read (int handle)
+{
+  unsigned sum = 0;
+  int n, i;
+
+  seek (handle, 0);
+  while ((n = read (handle, buf, CHUNK)) > 0)
+    for (i = 0; i < n; i++)
+      sum += (unsigned char) buf[i];
+  return sum;
+}
+
+/* Sums the SIZE bytes at MAP. */
+static unsigned
+sum_mapped (const char *map, int size)
+{
+  unsigned sum = 0;
+  int i;
+
+  for (i = 0; i < size; i++)
+    sum += (unsigned char) map[i];
+  return sum;
+}
+
+void
+test_main (void)
+{
+  int handle, size;
+  unsigned expected;
+  char *map;
+  size_t i;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  size = filesize (handle);
+  expected = sum_by_read (handle);
+  CHECK ((map = mmap (ACTUAL, size, 0, handle, 0)) != MAP_FAILED,
+         "mmap \"large.txt\"");
+
+  CHECK (madvise (map, size, MADV_WILLNEED) == 0, "madvise willneed");
+  CHECK (madvise (map, size, MADV_SEQUENTIAL) == 0, "madvise sequential");
+  if (sum_mapped (map, size) != expected)
+    fail ("bad data after sequential hint");
+  CHECK (madvise (map, size, MADV_RANDOM) == 0, "madvise random");
+  if (sum_mapped (map, size) != expected)
+    fail ("bad data after random hint");
+  munmap (map);
+  close (handle);
+
+  memset (anon, 0xaa, sizeof anon);
+  CHECK (madvise (anon, sizeof anon, MADV_DONTNEED) == 0, "madvise dontneed");
+  for (i = 0; i < sizeof anon; i += PAGE_SIZE)
+    if (get_phys_addr (&anon[i]) != 0)
+      fail ("page %zu still in memory after dontneed", i / PAGE_SIZE);
+  for (i = 0; i < sizeof anon; i++)
+    if (anon[i] != 0)
+      fail ("byte %zu not zero after dontneed", i);
+
+  data[0] = 'I';
+  CHECK (madvise ((void *) ((uintptr_t) data & ~(PAGE_SIZE - 1)), PAGE_SIZE,
+                  MADV_DONTNEED) == 0, "madvise dontneed on .data");
+  if (strcmp (data, "Initialized data") != 0)
+    fail (".data reads \"%s\" after dontneed", data);
+
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_SEQUENTIAL) == -1,
+         "madvise sequential on unmapped memory");
+  CHECK (madvise (anon + 1, PAGE_SIZE, MADV_DONTNEED) == -1,
+         "madvise misaligned");
+  CHECK (madvise (anon, PAGE_SIZE, 99) == -1, "madvise bad hint");
+}
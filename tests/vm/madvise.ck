@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise) begin
+(madvise) open "large.txt"
+(madvise) mmap "large.txt"
+(madvise) madvise willneed
+(madvise) madvise sequential
+(madvise) madvise random
+(madvise) madvise dontneed
+(madvise) madvise dontneed on .data
+(madvise) madvise sequential on unmapped memory
+(madvise) madvise misaligned
+(madvise) madvise bad hint
+(madvise) end
+EOF
+pass;
@@ -0,0 +1,51 @@
+/* Compares reading a large file through a mapping with reading
+   it with the read system call.  Each way sums every byte of
+   large.txt, timing the pass; the sums must agree.  A mapping
+   takes page faults but copies nothing, and fault-around should
+   keep the faults few, so it should come out ahead.
+
+   This is a benchmark: it only fails if a system call does or
+   the two sums differ. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define CHUNK 4096
+
+static char buf[CHUNK];
+
+void
+test_main (void)
+{
+  uint64_t start, read_cycles, mmap_cycles;
+  unsigned read_sum = 0, mmap_sum = 0;
+  int handle, size, n, i;
+  char *map;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  size = filesize (handle);
+
+  start = rdtsc ();
+  while ((n = read (handle, buf, CHUNK)) > 0)
+    for (i = 0; i < n; i++)
+      read_sum += (unsigned char) buf[i];
+  read_cycles = rdtsc () - start;
+
+  CHECK ((map = mmap (ACTUAL, size, 0, handle, 0)) != MAP_FAILED,
+         "mmap \"large.txt\"");
+  start = rdtsc ();
+  for (i = 0; i < size; i++)
+    mmap_sum += (unsigned char) map[i];
+  mmap_cycles = rdtsc () - start;
+  munmap (map);
+  close (handle);
+
+  if (read_sum != mmap_sum)
+    fail ("sum through mapping %u differs from sum by read %u",
+          mmap_sum, read_sum);
+  msg ("%d bytes: %llu cycles by read, %llu cycles by mapping",
+       size, read_cycles, mmap_cycles);
+}
@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,7 +34,40 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of each descriptor sits a magazine layer, after
+   Bonwick's "Magazines and Vmem".  A magazine is a small stack of
+   free blocks.  Each CPU keeps two magazines per descriptor, and
+   malloc() and free() normally just pop or push a block on them
+   with interrupts off, touching no lock and no data shared with
+   other CPUs.  When both of a CPU's magazines are empty (or both
+   full) it trades one with the descriptor's depot, which holds
+   spare full and empty magazines under a spin lock.  Only when
+   the depot has no full magazine does malloc() fall back to the
+   free list, and the depot keeps at most DEPOT_FULL_MAX full
+   magazines, sending any more back to their arenas, so that
+   unused arenas still get back to the page allocator. */
+
+/* Number of blocks a magazine holds. */
+#define MAG_ROUNDS 13
+
+/* Maximum number of full magazines in a descriptor's depot. */
+#define DEPOT_FULL_MAX 4
+
+/* A magazine: a stack of free blocks of one descriptor's size. */
+struct magazine {
+	struct list_elem elem;      /* Element in a depot list. */
+	size_t cnt;                 /* Number of blocks held. */
+	void *rounds[MAG_ROUNDS];   /* The blocks. */
+};
+
+/* A CPU's magazines for one descriptor, on their own cache line.
+   Either may be null.  PREVIOUS is always full or empty. */
+struct cpu_cache {
+	struct magazine *loaded;    /* Allocate from and free to this. */
+	struct magazine *previous;  /* Spare, swapped with LOADED. */
+} __attribute__ ((aligned (64)));
 
 /* Descriptor. */
 struct desc {
@@ -40,6 +75,12 @@ struct desc {
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
 	struct lock lock;           /* Lock. */
+
+	struct cpu_cache caches[CPU_MAX]; /* Per-CPU magazines. */
+	struct spinlock depot_lock; /* Protects the depot members below. */
+	struct list full_mags;      /* Depot's full magazines. */
+	struct list empty_mags;     /* Depot's empty magazines. */
+	size_t full_cnt;            /* Number of magazines in full_mags. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -60,9 +101,17 @@ struct block {
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
+static struct desc *mag_desc;   /* Descriptor magazines come from. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct desc *size_to_desc (size_t);
+static struct block *desc_alloc (struct desc *);
+static void desc_free (struct desc *, struct block *);
+static void *mag_alloc (struct desc *);
+static bool mag_free (struct desc *, void *);
+static void mag_flush (struct desc *, struct magazine *);
+static bool depot_reclaim (void);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -76,7 +125,25 @@ malloc_init (void) {
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
 		lock_init (&d->lock);
+		spin_init (&d->depot_lock);
+		list_init (&d->full_mags);
+		list_init (&d->empty_mags);
+		d->full_cnt = 0;
 	}
+	mag_desc = size_to_desc (sizeof (struct magazine));
+	ASSERT (mag_desc != NULL);
+}
+
+/* Returns the smallest descriptor for SIZE-byte blocks, or a null
+   pointer if SIZE is too big for any descriptor. */
+static struct desc *
+size_to_desc (size_t size) {
+	struct desc *d;
+
+	for (d = descs; d < descs + desc_cnt; d++)
+		if (d->block_size >= size)
+			return d;
+	return NULL;
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -93,10 +160,8 @@ malloc (size_t size) {
 
 	/* Find the smallest descriptor that satisfies a SIZE-byte
 	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
+	d = size_to_desc (size);
+	if (d == NULL) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
@@ -112,6 +177,60 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
+	b = mag_alloc (d);
+	if (b == NULL) {
+		b = desc_alloc (d);
+		if (b == NULL && depot_reclaim ())
+			b = desc_alloc (d);
+	}
+	return b;
+}
+
+/* Takes a block from this CPU's magazines for D, trading an empty
+   magazine for a full one from the depot if necessary.  Returns
+   a null pointer if the depot has no full magazine either. */
+static void *
+mag_alloc (struct desc *d) {
+	struct cpu_cache *cc;
+	struct magazine *m;
+	void *b = NULL;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	cc = &d->caches[cpu_id ()];
+	if (cc->loaded == NULL || cc->loaded->cnt == 0) {
+		if (cc->previous != NULL && cc->previous->cnt > 0) {
+			m = cc->loaded;
+			cc->loaded = cc->previous;
+			cc->previous = m;
+		} else {
+			spin_lock (&d->depot_lock);
+			if (!list_empty (&d->full_mags)) {
+				m = list_entry (list_pop_front (&d->full_mags),
+						struct magazine, elem);
+				d->full_cnt--;
+				if (cc->previous != NULL)
+					list_push_front (&d->empty_mags, &cc->previous->elem);
+				cc->previous = cc->loaded;
+				cc->loaded = m;
+			}
+			spin_unlock (&d->depot_lock);
+		}
+	}
+	if (cc->loaded != NULL && cc->loaded->cnt > 0)
+		b = cc->loaded->rounds[--cc->loaded->cnt];
+	intr_set_level (old_level);
+	return b;
+}
+
+/* Takes a block from D's free list, first carving a new arena
+   out of a fresh page if the list is empty.  Returns a null
+   pointer if no page is available. */
+static struct block *
+desc_alloc (struct desc *d) {
+	struct block *b;
+	struct arena *a;
+
 	lock_acquire (&d->lock);
 
 	/* If the free list is empty, create a new arena. */
@@ -196,6 +315,24 @@ realloc (void *old_block, size_t new_size) {
 	}
 }
 
+/* Returns a new block holding a copy of BLOCK, which must have
+   been allocated with malloc(), calloc(), or realloc(), or a null
+   pointer if BLOCK is null or memory is exhausted.  Lets code
+   that owns a block of a type it does not know duplicate it. */
+void *
+malloc_copy (void *block) {
+	void *copy;
+	size_t size;
+
+	if (block == NULL)
+		return NULL;
+	size = block_size (block);
+	copy = malloc (size);
+	if (copy != NULL)
+		memcpy (copy, block, size);
+	return copy;
+}
+
 /* Frees block P, which must have been previously allocated with
    malloc(), calloc(), or realloc(). */
 void
@@ -213,24 +350,18 @@ free (void *p) {
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
+			while (!mag_free (d, b)) {
+				/* The depot is out of empty magazines: make one. */
+				struct magazine *m = (struct magazine *) desc_alloc (mag_desc);
+				if (m == NULL) {
+					desc_free (d, b);
+					break;
 				}
-				palloc_free_page (a);
+				m->cnt = 0;
+				spin_lock (&d->depot_lock);
+				list_push_front (&d->empty_mags, &m->elem);
+				spin_unlock (&d->depot_lock);
 			}
-
-			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
 			palloc_free_multiple (a, a->free_cnt);
@@ -239,6 +370,116 @@ free (void *p) {
 	}
 }
 
+/* Puts block B on this CPU's magazines for D, trading a full
+   magazine for an empty one from the depot if necessary.
+   Returns false, without freeing B, if the depot has no empty
+   magazine to trade. */
+static bool
+mag_free (struct desc *d, void *b) {
+	struct cpu_cache *cc;
+	struct magazine *m, *excess = NULL;
+	bool success = true;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	cc = &d->caches[cpu_id ()];
+	if (cc->loaded == NULL || cc->loaded->cnt == MAG_ROUNDS) {
+		if (cc->previous != NULL && cc->previous->cnt < MAG_ROUNDS) {
+			m = cc->loaded;
+			cc->loaded = cc->previous;
+			cc->previous = m;
+		} else {
+			spin_lock (&d->depot_lock);
+			if (!list_empty (&d->empty_mags)) {
+				m = list_entry (list_pop_front (&d->empty_mags),
+						struct magazine, elem);
+				if (cc->previous != NULL) {
+					if (d->full_cnt < DEPOT_FULL_MAX) {
+						list_push_front (&d->full_mags, &cc->previous->elem);
+						d->full_cnt++;
+					} else
+						excess = cc->previous;
+				}
+				cc->previous = cc->loaded;
+				cc->loaded = m;
+			} else
+				success = false;
+			spin_unlock (&d->depot_lock);
+		}
+	}
+	if (success)
+		cc->loaded->rounds[cc->loaded->cnt++] = b;
+	intr_set_level (old_level);
+
+	if (excess != NULL)
+		mag_flush (d, excess);
+	return success;
+}
+
+/* Returns every block in full magazine M to D's arenas, then
+   puts the emptied M in D's depot. */
+static void
+mag_flush (struct desc *d, struct magazine *m) {
+	while (m->cnt > 0)
+		desc_free (d, m->rounds[--m->cnt]);
+	spin_lock (&d->depot_lock);
+	list_push_front (&d->empty_mags, &m->elem);
+	spin_unlock (&d->depot_lock);
+}
+
+/* Flushes every full magazine in every depot back to its arenas,
+   so that unused arenas go back to the page allocator.  Returns
+   true if any block was flushed. */
+static bool
+depot_reclaim (void) {
+	struct desc *d;
+	bool flushed = false;
+
+	for (d = descs; d < descs + desc_cnt; d++)
+		for (;;) {
+			struct magazine *m = NULL;
+
+			spin_lock (&d->depot_lock);
+			if (!list_empty (&d->full_mags)) {
+				m = list_entry (list_pop_front (&d->full_mags),
+						struct magazine, elem);
+				d->full_cnt--;
+			}
+			spin_unlock (&d->depot_lock);
+			if (m == NULL)
+				break;
+			mag_flush (d, m);
+			flushed = true;
+		}
+	return flushed;
+}
+
+/* Adds block B to D's free list, giving B's arena back to the
+   page allocator if that leaves it entirely unused. */
+static void
+desc_free (struct desc *d, struct block *b) {
+	struct arena *a = block_to_arena (b);
+
+	lock_acquire (&d->lock);
+
+	/* Add block to free list. */
+	list_push_front (&d->free_list, &b->free_elem);
+
+	/* If the arena is now entirely unused, free it. */
+	if (++a->free_cnt >= d->blocks_per_arena) {
+		size_t i;
+
+		ASSERT (a->free_cnt == d->blocks_per_arena);
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_remove (&b->free_elem);
+		}
+		palloc_free_page (a);
+	}
+
+	lock_release (&d->lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
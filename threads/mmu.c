@@ -2,12 +2,55 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+ *
+ * With CR4.PCIDE set, the CPU tags each TLB entry with the 12-bit
+ * PCID in the low bits of CR3, and a CR3 load with CR3_NOFLUSH
+ * set keeps the entries of every PCID.  Switching back to a page
+ * map that ran on this CPU recently then finds its translations
+ * still cached, where a plain CR3 load would flush them all.
+ *
+ * Each CPU lends PCID_SLOTS PCIDs, 1 to PCID_SLOTS, to the page
+ * maps that run on it, taking back the least recently used one
+ * when it runs out; PCID 0 belongs to base_pml4, whose mappings
+ * never change.  The first load with a newly lent PCID does not
+ * set CR3_NOFLUSH, which drops whatever its last owner left.
+ *
+ * A mapping changed in the active page map is flushed with invlpg,
+ * as before.  One changed in a page map that is not active, as
+ * copy-on-write and the clock do, is noted in that page map's slot
+ * on every CPU: a few addresses are flushed with invlpg right
+ * after the next load, more make that load flush the PCID. */
+#define PCID_SLOTS 8
+#define PCID_STALE_MAX 16
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PCIDE (1 << 17)
+
+/* A PCID lent to a page map on one CPU. */
+struct pcid_slot {
+	uint64_t *pml4;                 /* Borrower, or NULL if free. */
+	uint64_t last_use;              /* Activation count at last load. */
+	unsigned stale_cnt;             /* Addresses to flush, or more. */
+	uint64_t stale[PCID_STALE_MAX]; /* Addresses changed meanwhile. */
+};
+
+/* A CPU's PCIDs.  Only touched with interrupts off, by the CPU
+ * itself, except that any CPU may add stale addresses. */
+struct pcid_cpu {
+	struct pcid_slot slots[PCID_SLOTS];
+	uint64_t activations;           /* CR3 loads so far. */
+};
+
+static struct pcid_cpu pcid_cpus[CPU_MAX];
+static bool pcid_enabled;
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -23,6 +66,9 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		/* A huge page has no page table: its PDE is the entry. */
+		if (pdp[idx] & PTE_PS)
+			return &pdp[idx];
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
@@ -60,7 +106,9 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a huge page, returns the address of its PDE,
+ * which has PTE_PS set. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +136,32 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, that is, of the entry that either maps VA's
+ * 2 MB region as a huge page or points to its page table.
+ * Missing upper levels are created if CREATE is true; otherwise a
+ * null pointer is returned for them.  The returned entry itself
+ * may be empty. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *pdpe;
+
+	if (!(pml4[PML4 (va)] & PTE_P)) {
+		uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (new_page == NULL)
+			return NULL;
+		pml4[PML4 (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (va)]));
+	if (!(pdpe[PDPE (va)] & PTE_P)) {
+		uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (new_page == NULL)
+			return NULL;
+		pdpe[PDPE (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return (uint64_t *) ptov (PTE_ADDR (pdpe[PDPE (va)])) + PDX (va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +196,17 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -143,7 +224,8 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * A huge page is passed once, as its PDE and first address. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,7 +251,8 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* Huge pages only come from the VM, which frees them. */
+		if (((uint64_t) pte) & PTE_P && !(pdp[i] & PTE_PS))
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -192,6 +275,21 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	/* Take back its PCIDs, so that a page map allocated in the
+	 * same page later does not inherit them. */
+	if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		int cpu, i;
+
+		for (cpu = 0; cpu < cpu_count (); cpu++)
+			for (i = 0; i < PCID_SLOTS; i++)
+				if (pcid_cpus[cpu].slots[i].pml4 == pml4) {
+					pcid_cpus[cpu].slots[i].pml4 = NULL;
+					pcid_cpus[cpu].slots[i].last_use = 0;
+				}
+		intr_set_level (old_level);
+	}
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -199,11 +297,120 @@ pml4_destroy (uint64_t *pml4) {
 	palloc_free_page ((void *) pml4);
 }
 
+/* Turns on PCIDs, if the CPU has them.  Base_pml4 must be active,
+ * so that CR3 holds PCID 0 as the switch requires. */
+void
+pcid_init (void) {
+	uint32_t a = 1, b, c = 0, d;
+
+	asm volatile ("cpuid" : "+a" (a), "=b" (b), "+c" (c), "=d" (d));
+	if (!(c & (1 << 17)))
+		return;
+	ASSERT (rcr3 () == vtop (base_pml4));
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Returns the value to load into CR3 to activate PML4, other than
+ * base_pml4, on the current CPU, lending it a PCID if it does not
+ * have one here.  If addresses noted stale have to be flushed with
+ * invlpg once CR3 is loaded, sets *STALE_SLOT to the slot that
+ * holds them, otherwise to NULL.  Interrupts must be off. */
+static uint64_t
+pcid_cr3 (uint64_t *pml4, struct pcid_slot **stale_slot) {
+	struct pcid_cpu *pc = &pcid_cpus[cpu_id ()];
+	struct pcid_slot *slot = NULL;
+	unsigned i;
+
+	*stale_slot = NULL;
+	pc->activations++;
+	for (i = 0; i < PCID_SLOTS; i++)
+		if (pc->slots[i].pml4 == pml4) {
+			slot = &pc->slots[i];
+			break;
+		}
+
+	if (slot == NULL) {
+		/* Take the least recently used PCID and flush it. */
+		slot = &pc->slots[0];
+		for (i = 1; i < PCID_SLOTS; i++)
+			if (pc->slots[i].last_use < slot->last_use)
+				slot = &pc->slots[i];
+		slot->pml4 = pml4;
+		slot->stale_cnt = 0;
+		slot->last_use = pc->activations;
+		return vtop (pml4) | (slot - pc->slots + 1);
+	}
+
+	slot->last_use = pc->activations;
+	if (slot->stale_cnt > PCID_STALE_MAX) {
+		slot->stale_cnt = 0;
+		return vtop (pml4) | (slot - pc->slots + 1);
+	}
+	if (slot->stale_cnt > 0)
+		*stale_slot = slot;
+	return vtop (pml4) | (slot - pc->slots + 1) | CR3_NOFLUSH;
+}
+
+/* Notes that the mapping of VA in PML4, which is not active on
+ * this CPU, has changed, so that every CPU that lent PML4 a PCID
+ * flushes VA before PML4 next runs there. */
+static void
+pcid_note_stale (uint64_t *pml4, uint64_t va) {
+	enum intr_level old_level = intr_disable ();
+	int cpu, i;
+
+	for (cpu = 0; cpu < cpu_count (); cpu++)
+		for (i = 0; i < PCID_SLOTS; i++) {
+			struct pcid_slot *slot = &pcid_cpus[cpu].slots[i];
+			if (slot->pml4 == pml4) {
+				if (slot->stale_cnt < PCID_STALE_MAX)
+					slot->stale[slot->stale_cnt] = va;
+				if (slot->stale_cnt <= PCID_STALE_MAX)
+					slot->stale_cnt++;
+			}
+		}
+	intr_set_level (old_level);
+}
+
+/* Flushes the TLB entry for VA in PML4 after its mapping changed:
+ * with invlpg if PML4 is active, otherwise at its next
+ * activation.  Without PCIDs, every activation flushes anyway. */
+static void
+tlb_flush_va (uint64_t *pml4, uint64_t va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg (va);
+	else if (pcid_enabled)
+		pcid_note_stale (pml4, va);
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, the TLB entries of PML4 and of the page
+ * maps that ran before it stay cached (see the top of this
+ * file). */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	struct pcid_slot *stale_slot;
+	enum intr_level old_level;
+	unsigned i;
+
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4 ? pml4 : base_pml4));
+		return;
+	}
+	if (pml4 == NULL || pml4 == base_pml4) {
+		lcr3 (vtop (base_pml4) | CR3_NOFLUSH);
+		return;
+	}
+
+	old_level = intr_disable ();
+	lcr3 (pcid_cr3 (pml4, &stale_slot));
+	if (stale_slot != NULL) {
+		for (i = 0; i < stale_slot->stale_cnt; i++)
+			invlpg (stale_slot->stale[i]);
+		stale_slot->stale_cnt = 0;
+	}
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,11 +423,67 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & HPGMASK);
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
+/* Replaces the huge page mapped by PDE, the entry for address VA
+ * in PML4, by a page table mapping the same 2 MB with 4 kB pages
+ * and the same permission, accessed and dirty bits.  Returns false
+ * if the page table cannot be allocated. */
+static bool
+split_huge_page (uint64_t *pml4, uint64_t *pde, uint64_t va) {
+	uint64_t *pt = palloc_get_page (0);
+	uint64_t pa = PTE_ADDR (*pde);
+	uint64_t pte_flags = *pde & PTE_FLAGS & ~(uint64_t) PTE_PS;
+	unsigned i;
+
+	if (pt == NULL)
+		return false;
+	for (i = 0; i < HPGPAGES; i++)
+		pt[i] = (pa + i * PGSIZE) | pte_flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+
+	/* One invlpg drops the whole 2 MB TLB entry. */
+	tlb_flush_va (pml4, va);
+	return true;
+}
+
+/* Returns the PTE for 4 kB page VPAGE in PML4, as pml4e_walk()
+ * with CREATE, first splitting the huge page VPAGE lies in, if
+ * any.  Returns a null pointer if there is no PTE and CREATE is
+ * false, or if memory allocation fails; *OOM tells the two apart,
+ * if OOM is not null. */
+static uint64_t *
+pte_walk_4k (uint64_t *pml4, const void *vpage, int create, bool *oom) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, create);
+
+	if (oom != NULL)
+		*oom = false;
+	if (pte != NULL && (*pte & PTE_PS)) {
+		if (!split_huge_page (pml4, pte, (uint64_t) vpage)) {
+			if (oom != NULL)
+				*oom = true;
+			return NULL;
+		}
+		pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	}
+	return pte;
+}
+
+/* Returns the PDE of the huge page that maps VPAGE in PML4, or a
+ * null pointer if VPAGE does not lie in a present huge page. */
+static uint64_t *
+huge_pde (uint64_t *pml4, const void *vpage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+
+	return pte != NULL && (*pte & PTE_PS) ? pte : NULL;
+}
+
 /* Adds a mapping in page map level 4 PML4 from user virtual page
  * UPAGE to the physical frame identified by kernel virtual address KPAGE.
  * UPAGE must not already be mapped. KPAGE should probably be a page obtained
@@ -236,30 +499,99 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	ASSERT (is_user_vaddr (upage));
 	ASSERT (pml4 != base_pml4);
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
+	uint64_t *pte = pte_walk_4k (pml4, upage, 1, NULL);
+
+	if (pte) {
+		uint64_t old = *pte;
 
-	if (pte)
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (old & PTE_P)
+			tlb_flush_va (pml4, (uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
+/* Maps the 2 MB of user virtual memory starting at UPAGE, which
+ * must be 2 MB aligned, to the physically contiguous, 2 MB
+ * aligned frames starting at kernel virtual address KPAGE, with a
+ * single PDE.  The region must not have any page mapped; an empty
+ * page table left behind by earlier mappings is freed.
+ * Returns true if successful, false if the region is in use or
+ * memory allocation failed. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t va = (uint64_t) upage;
+	uint64_t *pde;
+	unsigned i;
+
+	ASSERT ((va & HPGMASK) == 0);
+	ASSERT ((vtop (kpage) & HPGMASK) == 0);
+	ASSERT (is_user_vaddr ((uint8_t *) upage + HPGSIZE - 1));
+	ASSERT (pml4 != base_pml4);
+
+	pde = pml4e_walk_pde (pml4, va, true);
+	if (pde == NULL)
+		return false;
+
+	if (*pde & PTE_P) {
+		uint64_t *pt;
+
+		if (*pde & PTE_PS)
+			return false;
+		pt = ptov (PTE_ADDR (*pde));
+		for (i = 0; i < HPGPAGES; i++)
+			if (pt[i] & PTE_P)
+				return false;
+		*pde = 0;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	tlb_flush_va (pml4, va);
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
-void
+ * UPAGE need not be mapped.  Inside a huge page this splits it,
+ * so that the neighbours stay mapped; returns false if there is
+ * no memory for the page table, leaving UPAGE mapped. */
+bool
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
+	bool oom;
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pte_walk_4k (pml4, upage, false, &oom);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_flush_va (pml4, (uint64_t) upage);
 	}
+	return !oom;
+}
+
+/* Marks the whole 2 MB region starting at UPAGE "not present" in
+ * PML4, as pml4_clear_page() would each page of it, if a huge page
+ * maps it, without splitting it.  Does nothing otherwise. */
+void
+pml4_clear_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde;
+	ASSERT (((uint64_t) upage & HPGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pde = huge_pde (pml4, upage);
+	if (pde != NULL) {
+		*pde &= ~PTE_P;
+		tlb_flush_va (pml4, (uint64_t) upage);
+	}
+}
+
+/* Returns true if VPAGE lies in a huge page in PML4. */
+bool
+pml4_is_huge_page (uint64_t *pml4, const void *vpage) {
+	return huge_pde (pml4, vpage) != NULL;
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -273,18 +605,69 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
-void
+ * in PML4.  Marking a page inside a huge page dirty marks the
+ * whole 2 MB; cleaning one splits it first, unless it is clean
+ * already, so that its neighbours stay dirty.  Returns false if
+ * there is no memory for the page table, changing nothing. */
+bool
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = huge_pde (pml4, vpage);
+	bool oom = false;
+
+	if (pte == NULL || (dirty != ((*pte & PTE_D) != 0)))
+		pte = dirty ? pml4e_walk (pml4, (uint64_t) vpage, false)
+			: pte_walk_4k (pml4, vpage, false, &oom);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_va (pml4, (uint64_t) vpage);
+	}
+	return !oom;
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+ * VPAGE in PML4, leaving the rest of the mapping alone.  Nothing
+ * needs flushing if the bit already had that value.  Inside a
+ * huge page that already has that value nothing needs splitting
+ * either; otherwise the page is split first, and false returned,
+ * changing nothing, if there is no memory for the page table. */
+bool
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = huge_pde (pml4, vpage);
+	bool oom = false;
+
+	if (pte == NULL || (*pte & PTE_W) != (writable ? PTE_W : 0))
+		pte = pte_walk_4k (pml4, vpage, false, &oom);
+	if (pte && (*pte & PTE_W) != (writable ? PTE_W : 0)) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		tlb_flush_va (pml4, (uint64_t) vpage);
+	}
+	return !oom;
+}
+
+/* Sets the writable bit to WRITABLE for the whole 2 MB region
+ * starting at UPAGE in PML4, in place, if a huge page maps it.
+ * Does nothing otherwise. */
+void
+pml4_set_huge_writable (uint64_t *pml4, void *upage, bool writable) {
+	uint64_t *pde;
+	ASSERT (((uint64_t) upage & HPGMASK) == 0);
+
+	pde = huge_pde (pml4, upage);
+	if (pde != NULL && (*pde & PTE_W) != (writable ? PTE_W : 0)) {
+		if (writable)
+			*pde |= PTE_W;
+		else
+			*pde &= ~(uint64_t) PTE_W;
+
+		tlb_flush_va (pml4, (uint64_t) upage);
 	}
 }
 
@@ -299,7 +682,8 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  Inside a huge page, this sets or clears the bit
+   for the whole 2 MB. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -309,7 +693,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_va (pml4, (uint64_t) vpage);
 	}
 }
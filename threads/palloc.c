@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -24,13 +26,63 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   each aligned (relative to the pool base) on its own size, on
+   one free list per order.  An allocation of N pages takes the
+   smallest block of at least N pages, splitting bigger blocks in
+   half as needed, and gives back the unused tail.  A freed block
+   is merged with its "buddy", the other half of the block it was
+   split from, for as long as that buddy is free as a whole.
+   Both take O(log n) time.
+
+   The free lists are threaded through per-page arrays kept with
+   the used map, not through the free pages themselves, so free
+   memory is never touched.  A pool is protected by a spin lock,
+   because palloc_free_page() is called while scheduling.
+
+   Each pool also keeps a small reserve of pages that were zeroed
+   ahead of time by the idle thread (see palloc_zero_idle()), so
+   that a single-page PAL_ZERO request, the common case for page
+   faults and fork, does not have to clear the page itself.
+   Reserved pages are allocated as far as the buddy allocator is
+   concerned and are linked through the same per-page links; they
+   go back to the free lists whenever an allocation would
+   otherwise fail. */
+
+/* Free blocks span up to 2**MAX_ORDER pages. */
+#define MAX_ORDER 20
+
+/* Null page index in free lists; free_order of an in-use page. */
+#define NIL UINT32_MAX
+#define NOT_FREE UINT8_MAX
+
+/* Pages kept pre-zeroed per pool, and the number of free pages
+   below which the idle thread stops taking more for the reserve. */
+#define ZERO_RESERVE 32
+#define ZERO_MIN_FREE 128
+
+/* Free list links of a page that starts a free block. */
+struct buddy_link {
+	uint32_t prev, next;            /* Neighbouring blocks, or NIL. */
+};
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
+	struct spinlock lock;           /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	struct buddy_link *links;       /* Free list links, by page. */
+	uint8_t *free_order;            /* Order of free block at page. */
+	uint32_t free_lists[MAX_ORDER + 1]; /* First free block by order. */
+	size_t free_cnt;                /* Number of free pages. */
+	uint32_t zero_list;             /* First pre-zeroed page, or NIL. */
+	size_t zero_cnt;                /* Number of pre-zeroed pages. */
+	size_t zero_hits;               /* PAL_ZERO served from reserve. */
+	size_t zero_misses;             /* PAL_ZERO zeroed on demand. */
+	size_t zero_bg;                 /* Pages zeroed while idle. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +94,11 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free_range (struct pool *, size_t page_idx,
+		size_t page_cnt);
+static size_t zero_pop (struct pool *);
+static void zero_drain (struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -223,12 +280,12 @@ split:
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free_range (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free_range (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -256,25 +313,46 @@ palloc_init (void) {
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   then the pages are filled with zeros; a single page comes from
+   the pool's pre-zeroed reserve if it has one.  If too few pages
+   are available, returns a null pointer, unless PAL_ASSERT is set
+   in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+	size_t page_idx = BITMAP_ERROR;
+	bool zeroed = false;
 	void *pages;
 
+	if (page_cnt > 0) {
+		spin_lock (&pool->lock);
+		if (page_cnt == 1 && (flags & PAL_ZERO)) {
+			page_idx = zero_pop (pool);
+			zeroed = page_idx != BITMAP_ERROR;
+		}
+		if (flags & PAL_ZERO) {
+			if (zeroed)
+				pool->zero_hits++;
+			else
+				pool->zero_misses++;
+		}
+		if (page_idx == BITMAP_ERROR)
+			page_idx = buddy_alloc (pool, page_cnt);
+		if (page_idx == BITMAP_ERROR && pool->zero_cnt > 0) {
+			/* Out of memory: the reserve is only a cache. */
+			zero_drain (pool);
+			page_idx = buddy_alloc (pool, page_cnt);
+		}
+		spin_unlock (&pool->lock);
+	}
+
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
 	else
 		pages = NULL;
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
 		if (flags & PAL_ASSERT)
@@ -296,6 +374,50 @@ palloc_get_page (enum palloc_flags flags) {
 	return palloc_get_multiple (flags, 1);
 }
 
+/* Obtains HPGPAGES contiguous free pages whose physical address
+   is HPGSIZE aligned, so that they can be mapped as one huge page,
+   and returns the kernel virtual address of the first.  FLAGS are
+   as for palloc_get_multiple().  The pages are freed with
+   palloc_free_multiple(), as a whole or in pieces. */
+void *
+palloc_get_huge (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t base_ofs = pg_no (vtop (pool->base)) % HPGPAGES;
+	size_t skew = base_ofs ? HPGPAGES - base_ofs : 0;
+	size_t block_cnt = skew ? 2 * HPGPAGES : HPGPAGES;
+	size_t page_idx;
+	void *pages;
+
+	/* Buddy blocks are aligned to their size within the pool, so a
+	   block of HPGPAGES is physically aligned only if the pool base
+	   is.  Otherwise take a block twice as big, which has an aligned
+	   run SKEW pages in, and give back the rest. */
+	spin_lock (&pool->lock);
+	page_idx = buddy_alloc (pool, block_cnt);
+	if (page_idx == BITMAP_ERROR && pool->zero_cnt > 0) {
+		zero_drain (pool);
+		page_idx = buddy_alloc (pool, block_cnt);
+	}
+	if (page_idx != BITMAP_ERROR && skew) {
+		buddy_free_range (pool, page_idx, skew);
+		buddy_free_range (pool, page_idx + skew + HPGPAGES,
+				HPGPAGES - skew);
+		page_idx += skew;
+	}
+	spin_unlock (&pool->lock);
+
+	if (page_idx == BITMAP_ERROR) {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get_huge: out of pages");
+		return NULL;
+	}
+	pages = pool->base + PGSIZE * page_idx;
+	ASSERT ((vtop (pages) & HPGMASK) == 0);
+	if (flags & PAL_ZERO)
+		memset (pages, 0, HPGSIZE);
+	return pages;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
@@ -318,8 +440,10 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	spin_lock (&pool->lock);
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_free_range (pool, page_idx, page_cnt);
+	spin_unlock (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +452,17 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the kernel virtual address of the first page of the
+   user pool and stores the number of pages in the pool in
+   *PAGE_CNT.  Every page palloc_get_page (PAL_USER) can return is
+   PGSIZE * I bytes past it for some I < *PAGE_CNT, so per-page
+   data can be kept in an array indexed by I. */
+void *
+palloc_user_pool (size_t *page_cnt) {
+	*page_cnt = bitmap_size (user_pool.used_map);
+	return user_pool.base;
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -335,18 +470,251 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
-
-	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	size_t links_size = ROUND_UP (pgcnt * sizeof *p->links, sizeof (long));
+	size_t bm_size = bitmap_buf_size (pgcnt);
+	size_t bm_pages = DIV_ROUND_UP (links_size + bm_size + pgcnt, PGSIZE)
+		* PGSIZE;
+	int order;
+
+	ASSERT (pgcnt < NIL);
+
+	spin_init(&p->lock);
+	p->links = *bm_base;
+	p->used_map = bitmap_create_in_buf (pgcnt, (uint8_t *) *bm_base + links_size,
+			bm_size);
+	p->free_order = (uint8_t *) *bm_base + links_size + bm_size;
 	p->base = (void *) start;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	memset (p->free_order, NOT_FREE, pgcnt);
+	for (order = 0; order <= MAX_ORDER; order++)
+		p->free_lists[order] = NIL;
+	p->free_cnt = 0;
+	p->zero_list = NIL;
+	p->zero_cnt = 0;
+	p->zero_hits = p->zero_misses = p->zero_bg = 0;
 
 	*bm_base += bm_pages;
 }
 
+/* Puts the free block of 2**ORDER pages at PAGE_IDX in POOL on
+   its free list. */
+static void
+block_push (struct pool *pool, size_t page_idx, int order) {
+	uint32_t head = pool->free_lists[order];
+
+	pool->links[page_idx].prev = NIL;
+	pool->links[page_idx].next = head;
+	if (head != NIL)
+		pool->links[head].prev = page_idx;
+	pool->free_lists[order] = page_idx;
+	pool->free_order[page_idx] = order;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX in POOL off
+   its free list. */
+static void
+block_remove (struct pool *pool, size_t page_idx, int order) {
+	struct buddy_link *l = &pool->links[page_idx];
+
+	ASSERT (pool->free_order[page_idx] == order);
+	if (l->prev != NIL)
+		pool->links[l->prev].next = l->next;
+	else
+		pool->free_lists[order] = l->next;
+	if (l->next != NIL)
+		pool->links[l->next].prev = l->prev;
+	pool->free_order[page_idx] = NOT_FREE;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is big
+   enough.  POOL's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	size_t page_idx, block_cnt;
+	int order, o;
+
+	for (order = 0; ((size_t) 1 << order) < page_cnt; order++)
+		if (order == MAX_ORDER)
+			return BITMAP_ERROR;
+
+	for (o = order; o <= MAX_ORDER && pool->free_lists[o] == NIL; o++)
+		continue;
+	if (o > MAX_ORDER)
+		return BITMAP_ERROR;
+
+	/* Split the block down to the order we need, freeing the
+	   upper half each time. */
+	page_idx = pool->free_lists[o];
+	block_remove (pool, page_idx, o);
+	while (o > order) {
+		o--;
+		block_push (pool, page_idx + ((size_t) 1 << o), o);
+	}
+
+	block_cnt = (size_t) 1 << order;
+	bitmap_set_multiple (pool->used_map, page_idx, block_cnt, true);
+	pool->free_cnt -= block_cnt;
+
+	/* Give back the tail we do not need. */
+	if (page_cnt < block_cnt)
+		buddy_free_range (pool, page_idx + page_cnt, block_cnt - page_cnt);
+	return page_idx;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy as long as possible. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order) {
+	size_t pool_cnt = bitmap_size (pool->used_map);
+
+	while (order < MAX_ORDER) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+		if (buddy + ((size_t) 1 << order) > pool_cnt
+				|| pool->free_order[buddy] != order)
+			break;
+		block_remove (pool, buddy, order);
+		page_idx &= ~((size_t) 1 << order);
+		order++;
+	}
+	block_push (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   biggest aligned blocks that fit.  POOL's lock must be held,
+   except during initialization. */
+static void
+buddy_free_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool->free_cnt += page_cnt;
+
+	while (page_cnt > 0) {
+		int order = 0;
+		while (order < MAX_ORDER
+				&& (page_idx & ((size_t) 1 << order)) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		buddy_free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Takes a page off POOL's pre-zeroed reserve and returns its
+   index, or BITMAP_ERROR if the reserve is empty.  POOL's lock
+   must be held. */
+static size_t
+zero_pop (struct pool *pool) {
+	uint32_t page_idx = pool->zero_list;
+
+	if (page_idx == NIL)
+		return BITMAP_ERROR;
+	pool->zero_list = pool->links[page_idx].next;
+	pool->zero_cnt--;
+	return page_idx;
+}
+
+/* Returns every page in POOL's pre-zeroed reserve to the free
+   lists.  POOL's lock must be held. */
+static void
+zero_drain (struct pool *pool) {
+	size_t page_idx;
+
+	while ((page_idx = zero_pop (pool)) != BITMAP_ERROR)
+		buddy_free_range (pool, page_idx, 1);
+}
+
+/* Zeroes one page for POOL's reserve if it is short and memory
+   is not.  Returns true if a page was zeroed. */
+static bool
+zero_refill (struct pool *pool) {
+	size_t page_idx = BITMAP_ERROR;
+
+	spin_lock (&pool->lock);
+	if (pool->zero_cnt < ZERO_RESERVE && pool->free_cnt > ZERO_MIN_FREE)
+		page_idx = buddy_alloc (pool, 1);
+	spin_unlock (&pool->lock);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	/* The page is ours, so clear it without the lock and with
+	   interrupts on. */
+	memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+	spin_lock (&pool->lock);
+	pool->links[page_idx].next = pool->zero_list;
+	pool->zero_list = page_idx;
+	pool->zero_cnt++;
+	pool->zero_bg++;
+	spin_unlock (&pool->lock);
+	return true;
+}
+
+/* Zeroes a page for the user or kernel pool's PAL_ZERO reserve,
+   user first.  Called by the idle thread with interrupts on, so
+   that any wakeup preempts it between pages.  Returns true if it
+   did some work and may be called again, false once both
+   reserves are full. */
+bool
+palloc_zero_idle (void) {
+	ASSERT (!intr_context ());
+	ASSERT (intr_get_level () == INTR_ON);
+
+	return zero_refill (&user_pool) || zero_refill (&kernel_pool);
+}
+
+/* Prints POOL's fragmentation report under NAME. */
+static void
+pool_print_stats (struct pool *pool, const char *name) {
+	size_t blocks[MAX_ORDER + 1];
+	size_t free_cnt, largest = 0;
+	size_t zero_cnt, zero_hits, zero_misses, zero_bg;
+	int order;
+
+	spin_lock (&pool->lock);
+	free_cnt = pool->free_cnt;
+	zero_cnt = pool->zero_cnt;
+	zero_hits = pool->zero_hits;
+	zero_misses = pool->zero_misses;
+	zero_bg = pool->zero_bg;
+	for (order = 0; order <= MAX_ORDER; order++) {
+		uint32_t idx;
+		blocks[order] = 0;
+		for (idx = pool->free_lists[order]; idx != NIL;
+				idx = pool->links[idx].next)
+			blocks[order]++;
+		if (blocks[order] > 0)
+			largest = (size_t) 1 << order;
+	}
+	spin_unlock (&pool->lock);
+
+	printf ("%s pool: %zu of %zu pages free, largest block %zu pages, "
+			"%zu%% fragmented\n", name, free_cnt,
+			bitmap_size (pool->used_map), largest,
+			free_cnt > 0 ? (free_cnt - largest) * 100 / free_cnt : 0);
+	printf ("  free blocks by order:");
+	for (order = 0; order <= MAX_ORDER; order++)
+		if (blocks[order] > 0)
+			printf (" %d:%zu", order, blocks[order]);
+	printf ("\n");
+	printf ("  zero reserve: %zu pages, %zu hits, %zu misses, "
+			"%zu zeroed while idle\n", zero_cnt, zero_hits, zero_misses,
+			zero_bg);
+}
+
+/* Prints a fragmentation report for both pools: free pages, the
+   largest free block, the number of free blocks of each order,
+   and how PAL_ZERO requests fared against the pre-zeroed reserve.
+   "Fragmented" is the share of free pages outside the
+   largest free block. */
+void
+palloc_print_stats (void) {
+	pool_print_stats (&kernel_pool, "Kernel");
+	pool_print_stats (&user_pool, "User");
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
@@ -0,0 +1,330 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Object-caching slab allocator, after Bonwick's "The Slab
+   Allocator: An Object-Caching Kernel Memory Allocator".
+
+   A cache hands out objects of a single type.  Its memory comes
+   from the page allocator one page, called a "slab", at a time.
+   Each slab starts with a header and is then carved into equal
+   slots, each holding one object followed by a link for the
+   slab's free list.  Keeping the link outside the object means a
+   free object keeps its contents, so a cache with a constructor
+   runs it only when a slab is created, and its destructor only
+   when the slab goes back to the page allocator: callers must
+   return objects to their constructed state before freeing them.
+
+   Slabs with free objects sit on the cache's partial list and
+   fully used ones on its full list.  One completely free slab is
+   kept in reserve; any others are released at once.
+
+   The space a slab cannot use for whole slots is spent on
+   "colouring": each new slab starts its first slot one cache
+   line further in than the previous slab did, wrapping around,
+   so that the same object in different slabs does not always
+   land in the same hardware cache set.
+
+   Caches are themselves objects, allocated from a statically
+   allocated cache of caches. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Cache line size, the colouring step and minimum alignment. */
+#define CACHE_LINE 64
+
+/* A cache of objects. */
+struct kmem_cache {
+	char name[16];              /* Name (for statistics). */
+	size_t size;                /* Object size in bytes. */
+	size_t align;               /* Object alignment. */
+	size_t slot_size;           /* Object plus link, aligned. */
+	size_t objs_per_slab;       /* Slots in a slab. */
+	size_t colour_max;          /* Largest colour offset. */
+	size_t colour_next;         /* Colour offset for next slab. */
+	size_t colour_step;         /* Colour increment. */
+	kmem_func *ctor;            /* Constructor, or null. */
+	kmem_func *dtor;            /* Destructor, or null. */
+	struct list_elem elem;      /* Element in cache_list. */
+
+	struct lock lock;           /* Protects the members below. */
+	struct list partial;        /* Slabs with some free slots. */
+	struct list full;           /* Slabs with no free slots. */
+	struct slab *spare;         /* Entirely free slab, or null. */
+
+	/* Statistics. */
+	unsigned long alloc_cnt;    /* # of kmem_cache_alloc() calls. */
+	unsigned long free_cnt;     /* # of kmem_cache_free() calls. */
+	unsigned long grow_cnt;     /* # of slabs taken from palloc. */
+	unsigned long reap_cnt;     /* # of slabs given back to palloc. */
+	size_t slab_cnt;            /* # of slabs currently owned. */
+};
+
+/* Slab header, at the start of its page. */
+struct slab {
+	unsigned magic;             /* Always SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in a cache list. */
+	uint8_t *first;             /* First slot. */
+	void **free;                /* Link of first free slot, or null. */
+	size_t inuse;               /* # of allocated objects. */
+};
+
+/* All caches, for statistics. */
+static struct list cache_list;
+static struct lock cache_list_lock;
+
+/* The cache of caches. */
+static struct kmem_cache cache_cache;
+
+static void cache_setup (struct kmem_cache *, const char *name,
+                         size_t size, size_t align,
+                         kmem_func *ctor, kmem_func *dtor);
+static struct slab *slab_create (struct kmem_cache *);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+
+/* Returns the link word of the object at OBJ in cache C. */
+static inline void **
+obj_link (const struct kmem_cache *c, void *obj) {
+	return (void **) ((uint8_t *) obj + c->slot_size - sizeof (void *));
+}
+
+/* Returns the object whose link word is LINK in cache C. */
+static inline void *
+link_obj (const struct kmem_cache *c, void **link) {
+	return (uint8_t *) link + sizeof (void *) - c->slot_size;
+}
+
+/* Initializes the slab allocator.  Must be called after
+   palloc_init(). */
+void
+slab_init (void) {
+	list_init (&cache_list);
+	lock_init (&cache_list_lock);
+	cache_setup (&cache_cache, "kmem_cache", sizeof (struct kmem_cache),
+			0, NULL, NULL);
+}
+
+/* Creates and returns a cache named NAME for SIZE-byte objects
+   aligned on ALIGN bytes, a power of 2 (0 for pointer alignment).
+   CTOR, if nonnull, is run on every object when its slab is
+   created, and DTOR, if nonnull, on every object when its slab is
+   released.  Returns a null pointer if memory is not available.
+   SIZE must be small enough that a page holds several objects. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_func *ctor, kmem_func *dtor) {
+	struct kmem_cache *c = kmem_cache_alloc (&cache_cache);
+	if (c != NULL)
+		cache_setup (c, name, size, align, ctor, dtor);
+	return c;
+}
+
+/* Destroys cache C, which must have no allocated objects. */
+void
+kmem_cache_destroy (struct kmem_cache *c) {
+	ASSERT (c != NULL && c != &cache_cache);
+	ASSERT (list_empty (&c->partial) && list_empty (&c->full));
+
+	lock_acquire (&cache_list_lock);
+	list_remove (&c->elem);
+	lock_release (&cache_list_lock);
+
+	if (c->spare != NULL)
+		slab_destroy (c, c->spare);
+	kmem_cache_free (&cache_cache, c);
+}
+
+/* Initializes cache C.  See kmem_cache_create(). */
+static void
+cache_setup (struct kmem_cache *c, const char *name, size_t size,
+		size_t align, kmem_func *ctor, kmem_func *dtor) {
+	size_t usable, waste;
+
+	if (align < sizeof (void *))
+		align = sizeof (void *);
+	ASSERT ((align & (align - 1)) == 0);
+	ASSERT (size > 0);
+
+	strlcpy (c->name, name, sizeof c->name);
+	c->size = size;
+	c->align = align;
+	c->slot_size = ROUND_UP (size + sizeof (void *), align);
+	usable = PGSIZE - ROUND_UP (sizeof (struct slab), align);
+	c->objs_per_slab = usable / c->slot_size;
+	ASSERT (c->objs_per_slab >= 2);
+
+	/* Colour in cache-line steps, or in ALIGN steps if those are
+	   bigger, through the space no slot can use. */
+	waste = usable - c->objs_per_slab * c->slot_size;
+	c->colour_step = align > CACHE_LINE ? align : CACHE_LINE;
+	c->colour_max = waste / c->colour_step * c->colour_step;
+	c->colour_next = 0;
+
+	c->ctor = ctor;
+	c->dtor = dtor;
+	lock_init (&c->lock);
+	list_init (&c->partial);
+	list_init (&c->full);
+	c->spare = NULL;
+	c->alloc_cnt = c->free_cnt = c->grow_cnt = c->reap_cnt = 0;
+	c->slab_cnt = 0;
+
+	lock_acquire (&cache_list_lock);
+	list_push_back (&cache_list, &c->elem);
+	lock_release (&cache_list_lock);
+}
+
+/* Allocates and returns an object from cache C, in constructed
+   state.  Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	void **link;
+
+	ASSERT (c != NULL);
+
+	lock_acquire (&c->lock);
+	if (list_empty (&c->partial)) {
+		if (c->spare != NULL) {
+			s = c->spare;
+			c->spare = NULL;
+		} else {
+			s = slab_create (c);
+			if (s == NULL) {
+				lock_release (&c->lock);
+				return NULL;
+			}
+		}
+		list_push_front (&c->partial, &s->elem);
+	}
+
+	s = list_entry (list_front (&c->partial), struct slab, elem);
+	link = s->free;
+	s->free = *link;
+	if (++s->inuse == c->objs_per_slab) {
+		list_remove (&s->elem);
+		list_push_front (&c->full, &s->elem);
+	}
+	c->alloc_cnt++;
+	lock_release (&c->lock);
+
+	return link_obj (c, link);
+}
+
+/* Returns OBJ, which must have been allocated from cache C and be
+   back in its constructed state, to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+	void **link;
+
+	if (obj == NULL)
+		return;
+
+	s = pg_round_down (obj);
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+	ASSERT (((uint8_t *) obj - s->first) % c->slot_size == 0);
+
+	lock_acquire (&c->lock);
+	link = obj_link (c, obj);
+	*link = s->free;
+	s->free = link;
+	if (s->inuse-- == c->objs_per_slab) {
+		list_remove (&s->elem);
+		list_push_front (&c->partial, &s->elem);
+	}
+	if (s->inuse == 0) {
+		list_remove (&s->elem);
+		if (c->spare == NULL)
+			c->spare = s;
+		else
+			slab_destroy (c, s);
+	}
+	c->free_cnt++;
+	lock_release (&c->lock);
+}
+
+/* Takes a page from the page allocator and makes it a slab of
+   constructed objects for C.  Returns a null pointer if no page
+   is available. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	size_t i;
+
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->first = (uint8_t *) s + ROUND_UP (sizeof *s, c->align) + c->colour_next;
+	s->free = NULL;
+	s->inuse = 0;
+
+	c->colour_next += c->colour_step;
+	if (c->colour_next > c->colour_max)
+		c->colour_next = 0;
+
+	/* Thread slots onto the free list back to front, so the first
+	   allocation gets the first slot. */
+	for (i = c->objs_per_slab; i-- > 0; ) {
+		void *obj = s->first + i * c->slot_size;
+		if (c->ctor != NULL)
+			c->ctor (obj);
+		*obj_link (c, obj) = s->free;
+		s->free = obj_link (c, obj);
+	}
+
+	c->grow_cnt++;
+	c->slab_cnt++;
+	return s;
+}
+
+/* Destroys every object in slab S of cache C and gives S back to
+   the page allocator. */
+static void
+slab_destroy (struct kmem_cache *c, struct slab *s) {
+	ASSERT (s->inuse == 0);
+
+	if (c->dtor != NULL) {
+		size_t i;
+		for (i = 0; i < c->objs_per_slab; i++)
+			c->dtor (s->first + i * c->slot_size);
+	}
+	s->magic = 0;
+	palloc_free_page (s);
+
+	c->reap_cnt++;
+	c->slab_cnt--;
+}
+
+/* Prints statistics for every cache that was ever used. */
+void
+kmem_print_stats (void) {
+	struct list_elem *e;
+
+	if (list_empty (&cache_list))
+		return;
+
+	printf ("Slab caches:\n");
+	for (e = list_begin (&cache_list); e != list_end (&cache_list);
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+		if (c->alloc_cnt == 0)
+			continue;
+		printf ("  %-12s %4zu B x %3zu/slab: %lu allocs, %lu frees, "
+				"%zu slabs (%lu grown, %lu reaped)\n",
+				c->name, c->size, c->objs_per_slab, c->alloc_cnt,
+				c->free_cnt, c->slab_cnt, c->grow_cnt, c->reap_cnt);
+	}
+}
@@ -31,9 +31,63 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "intrinsic.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+static int rwlock_max_waiter (struct rwlock *);
+static void rwlock_donate (struct rwlock *, int priority, int depth);
+static void lock_init_at (struct lock *, const void *site);
+
+#ifdef LOCK_PROFILE
+/* Maximum number of lock classes that can be profiled. */
+#define LOCK_CLASS_MAX 128
+
+/* Maximum number of acquire sites profiled per lock class.
+   Acquisitions from further sites only count toward the class. */
+#define LOCK_SITE_MAX 6
+
+/* Counters for a lock class or for one of its acquire sites.
+   Times are in TSC ticks.  Counters are bumped atomically
+   because different locks of one class may be held at once. */
+struct lock_stats {
+  uint64_t acquire_cnt;         /* # of acquisitions. */
+  uint64_t contend_cnt;         /* # of those that had to wait. */
+  uint64_t wait_total;          /* Total time spent waiting. */
+  uint64_t wait_max;            /* Longest single wait. */
+  uint64_t hold_total;          /* Total time held. */
+};
+
+/* Profile of the acquisitions of a lock class from one caller of
+   lock_acquire() or lock_try_acquire(). */
+struct lock_site {
+  const void *site;             /* Caller, or NULL if slot is free. */
+  struct lock_stats stats;
+};
+
+/* Profile of a lock class, that is, of every lock initialized at
+   one call site.  Locks embedded in objects that come and go,
+   such as inodes, are thereby counted together and outlive the
+   objects themselves. */
+struct lock_class {
+  const void *init_site;        /* Caller of lock_init(). */
+  struct lock_stats stats;      /* All acquisitions. */
+  struct lock_site sites[LOCK_SITE_MAX]; /* By acquire site. */
+};
+
+static struct lock_class lock_classes[LOCK_CLASS_MAX];
+static int lock_class_cnt;
+static unsigned long lock_class_overflow; /* Locks left unprofiled. */
+static struct spinlock lock_class_lock;   /* Protects the above. */
+
+static struct lock_class *lock_class_lookup (const void *site);
+static struct lock_site *lock_site_lookup (struct lock_class *,
+                                           const void *site);
+static void lock_profile_acquired (struct lock *, bool contended,
+                                   uint64_t start, const void *site);
+static void lock_profile_released (struct lock *);
+#endif
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -168,10 +222,21 @@ static void sema_test_helper(void *sema_) {
    onerous, it's a good sign that a semaphore should be used,
    instead of a lock. */
 void lock_init(struct lock *lock) {
+    lock_init_at(lock, __builtin_return_address(0));
+}
+
+/* Initializes LOCK on behalf of the code at SITE, which names the
+   lock in profiles. */
+static void lock_init_at(struct lock *lock, const void *site UNUSED) {
     ASSERT(lock != NULL);
 
     lock->holder = NULL;
     sema_init(&lock->semaphore, 1);
+#ifdef LOCK_PROFILE
+    lock->class = lock_class_lookup(site);
+    lock->site = NULL;
+    lock->acquired_at = 0;
+#endif
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -188,15 +253,28 @@ void lock_acquire(struct lock *lock) {
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
   struct thread *cur = thread_current ();
-  if (lock->holder) {
-    cur->wait_on_lock = lock;
-    list_insert_ordered (&lock->holder->donations, &cur->donation_elem, 
-    			cmp_donation_priority, 0);
-    donate_priority ();
+  bool contended UNUSED = false;
+#ifdef LOCK_PROFILE
+  uint64_t start = rdtsc ();
+#endif
+
+  if (!sema_try_down (&lock->semaphore)) {
+    contended = true;
+    /* The MLFQS does not use priority donation. */
+    if (lock->holder && !thread_mlfqs) {
+      cur->wait_on_lock = lock;
+      list_insert_ordered (&lock->holder->donations, &cur->donation_elem, 
+      			cmp_donation_priority, 0);
+      donate_priority ();
+    }
+    sema_down (&lock->semaphore); 
+    cur->wait_on_lock = NULL;
   }
-  sema_down (&lock->semaphore); 
-  cur->wait_on_lock = NULL;
   lock->holder = cur;
+
+#ifdef LOCK_PROFILE
+  lock_profile_acquired (lock, contended, start, __builtin_return_address (0));
+#endif
 }
 
 bool cmp_donation_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
@@ -208,9 +286,16 @@ void donate_priority(void) {
   struct thread *cur = thread_current ();
 
   for (depth = 0; depth < 8; depth++){
-    if (!cur->wait_on_lock) break;
+    if (!cur->wait_on_lock) {
+      if (cur->wait_on_rwlock) {
+        enum intr_level old_level = intr_disable ();
+        rwlock_donate (cur->wait_on_rwlock, cur->priority, depth + 1);
+        intr_set_level (old_level);
+      }
+      break;
+    }
       struct thread *holder = cur->wait_on_lock->holder;
-      holder->priority = cur->priority;
+      thread_update_priority (holder, cur->priority);
       cur = holder;
   }
 }
@@ -227,8 +312,12 @@ bool lock_try_acquire(struct lock *lock) {
     ASSERT(!lock_held_by_current_thread(lock));
 
     success = sema_try_down(&lock->semaphore);
-    if (success)
+    if (success) {
         lock->holder = thread_current();
+#ifdef LOCK_PROFILE
+        lock_profile_acquired(lock, false, 0, __builtin_return_address(0));
+#endif
+    }
     return success;
 }
 
@@ -255,9 +344,14 @@ void lock_release(struct lock *lock) {
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  remove_with_lock (lock);
-  refresh_priority ();
+  if (!thread_mlfqs) {
+    remove_with_lock (lock);
+    refresh_priority ();
+  }
   
+#ifdef LOCK_PROFILE
+  lock_profile_released (lock);
+#endif
   lock->holder = NULL;
   sema_up (&lock->semaphore);
 }
@@ -274,6 +368,18 @@ void refresh_priority(void) {
     if (front->priority > cur->priority)
       cur->priority = front->priority;
   }
+
+  /* Waiters on rwlocks we still hold keep donating. */
+  enum intr_level old_level = intr_disable ();
+  for (int i = 0; i < RW_HOLD_MAX; i++) {
+    struct rwlock *rw = cur->rw_holds[i].rwlock;
+    if (rw != NULL) {
+      int pri = rwlock_max_waiter (rw);
+      if (pri > cur->priority)
+        cur->priority = pri;
+    }
+  }
+  intr_set_level (old_level);
 }
 /* Returns true if the current thread holds LOCK, false
    otherwise.  (Note that testing whether some other thread holds
@@ -283,6 +389,463 @@ bool lock_held_by_current_thread(const struct lock *lock) {
     return lock->holder == thread_current();
 }
 
+#ifdef LOCK_PROFILE
+/* Returns the profile for locks initialized at SITE, creating it
+   if necessary, or a null pointer if the table is full. */
+static struct lock_class *
+lock_class_lookup (const void *site)
+{
+  struct lock_class *c = NULL;
+  int i;
+
+  spin_lock (&lock_class_lock);
+  for (i = 0; i < lock_class_cnt; i++)
+    if (lock_classes[i].init_site == site) {
+      c = &lock_classes[i];
+      break;
+    }
+  if (c == NULL) {
+    if (lock_class_cnt < LOCK_CLASS_MAX) {
+      c = &lock_classes[lock_class_cnt++];
+      c->init_site = site;
+    } else
+      lock_class_overflow++;
+  }
+  spin_unlock (&lock_class_lock);
+  return c;
+}
+
+/* Returns the slot for acquisitions of class C from SITE,
+   claiming a free one if necessary, or a null pointer if all of
+   C's slots are taken by other sites. */
+static struct lock_site *
+lock_site_lookup (struct lock_class *c, const void *site)
+{
+  int i;
+
+  for (i = 0; i < LOCK_SITE_MAX; i++) {
+    struct lock_site *s = &c->sites[i];
+    const void *expected = NULL;
+
+    if (s->site == site
+        || __atomic_compare_exchange_n (&s->site, &expected, site, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+        || expected == site)
+      return s;
+  }
+  return NULL;
+}
+
+/* Adds an acquisition to STATS, which waited WAIT ticks if
+   CONTENDED. */
+static void
+lock_stats_acquired (struct lock_stats *stats, bool contended, uint64_t wait)
+{
+  __atomic_fetch_add (&stats->acquire_cnt, 1, __ATOMIC_RELAXED);
+  if (contended) {
+    uint64_t max = __atomic_load_n (&stats->wait_max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add (&stats->contend_cnt, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&stats->wait_total, wait, __ATOMIC_RELAXED);
+    while (wait > max
+           && !__atomic_compare_exchange_n (&stats->wait_max, &max, wait,
+                                            false, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+      continue;
+  }
+}
+
+/* Charges an acquisition of LOCK by the code at SITE to LOCK's
+   class and to SITE's slot in it.  If CONTENDED, the caller
+   started waiting at TSC value START. */
+static void
+lock_profile_acquired (struct lock *lock, bool contended, uint64_t start,
+                       const void *site)
+{
+  struct lock_class *c = lock->class;
+  uint64_t now = rdtsc ();
+  uint64_t wait = contended ? now - start : 0;
+
+  lock->acquired_at = now;
+  lock->site = NULL;
+  if (c == NULL)
+    return;
+
+  lock_stats_acquired (&c->stats, contended, wait);
+  lock->site = lock_site_lookup (c, site);
+  if (lock->site != NULL)
+    lock_stats_acquired (&lock->site->stats, contended, wait);
+}
+
+/* Charges the time LOCK has just been held to its class and to
+   the site that acquired it. */
+static void
+lock_profile_released (struct lock *lock)
+{
+  uint64_t held = rdtsc () - lock->acquired_at;
+
+  if (lock->class != NULL)
+    __atomic_fetch_add (&lock->class->stats.hold_total, held,
+                        __ATOMIC_RELAXED);
+  if (lock->site != NULL)
+    __atomic_fetch_add (&lock->site->stats.hold_total, held,
+                        __ATOMIC_RELAXED);
+}
+
+/* Formats line LINE of class C's part of the lock profile into
+   BUF, which has room for SIZE bytes: line 0 is the class as a
+   whole, and the following ones are its acquire sites.  Returns
+   false, leaving BUF alone, if C has no such line. */
+static bool
+lock_class_format (const struct lock_class *c, int line, char *buf,
+                   size_t size)
+{
+  const struct lock_stats *stats;
+  const void *site;
+
+  if (line == 0) {
+    site = c->init_site;
+    stats = &c->stats;
+  } else if (line <= LOCK_SITE_MAX && c->sites[line - 1].site != NULL) {
+    site = c->sites[line - 1].site;
+    stats = &c->sites[line - 1].stats;
+  } else
+    return false;
+
+  snprintf (buf, size, "%s%18p %10llu %10llu %14llu %12llu %14llu\n",
+            line == 0 ? "" : "  ", site,
+            (unsigned long long) stats->acquire_cnt,
+            (unsigned long long) stats->contend_cnt,
+            (unsigned long long) stats->wait_total,
+            (unsigned long long) stats->wait_max,
+            (unsigned long long) stats->hold_total);
+  return true;
+}
+
+static const char lock_profile_header[] =
+  "Lock profile (TSC ticks), by lock_init() site, each followed by\n"
+  "its lock_acquire() sites, indented:\n"
+  "         init site   acquires  contended     wait total     wait max"
+  "     hold total\n";
+#endif
+
+/* Prints the lock profile: a line for each lock class that was
+   ever acquired, followed by a line for each of its acquire
+   sites. */
+void
+lock_print_stats (void)
+{
+#ifdef LOCK_PROFILE
+  char line[128];
+  int i, j;
+
+  printf ("%s", lock_profile_header);
+  for (i = 0; i < lock_class_cnt; i++)
+    if (lock_classes[i].stats.acquire_cnt > 0)
+      for (j = 0; lock_class_format (&lock_classes[i], j, line, sizeof line);
+           j++)
+        printf ("%s", line);
+  if (lock_class_overflow > 0)
+    printf ("%lu locks not profiled: too many classes\n", lock_class_overflow);
+#endif
+}
+
+/* Copies as much of the lock profile as fits into BUF, which has
+   room for SIZE bytes, always null-terminating it if SIZE is
+   nonzero.  Returns the number of characters stored, not
+   counting the null terminator, or -1 if the kernel was built
+   without LOCK_PROFILE. */
+int
+lock_stats_read (char *buf UNUSED, size_t size UNUSED)
+{
+#ifdef LOCK_PROFILE
+  char line[128];
+  size_t len = 0;
+  int i, j;
+
+  if (size == 0)
+    return 0;
+  len = strlcpy (buf, lock_profile_header, size);
+  for (i = 0; i < lock_class_cnt && len < size - 1; i++)
+    if (lock_classes[i].stats.acquire_cnt > 0)
+      for (j = 0; len < size - 1
+                  && lock_class_format (&lock_classes[i], j, line,
+                                        sizeof line); j++)
+        len += strlcpy (buf + len, line, size - len);
+  return len < size ? (int) len : (int) size - 1;
+#else
+  return -1;
+#endif
+}
+
+/* Initializes RW as an unheld readers-writer lock.  Unlike a
+   lock, an rwlock may be held by several readers at once, which
+   suits data that is looked up far more often than changed.
+
+   Writers have preference: once a writer is waiting, new readers
+   wait behind it, so a steady stream of readers cannot starve
+   writers.  Every waiter donates its priority to all current
+   holders, readers included. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  list_init (&rw->holds);
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+}
+
+/* Records that T holds RW.  If T has no free hold slot the hold
+   is still valid but cannot receive donations.  Interrupts must
+   be off. */
+static void
+rwlock_add_hold (struct rwlock *rw, struct thread *t)
+{
+  for (int i = 0; i < RW_HOLD_MAX; i++) {
+    struct rw_hold *h = &t->rw_holds[i];
+    if (h->rwlock == NULL) {
+      h->rwlock = rw;
+      h->thread = t;
+      list_push_back (&rw->holds, &h->elem);
+      return;
+    }
+  }
+}
+
+/* Forgets one hold of RW by T.  Interrupts must be off. */
+static void
+rwlock_remove_hold (struct rwlock *rw, struct thread *t)
+{
+  for (int i = 0; i < RW_HOLD_MAX; i++) {
+    struct rw_hold *h = &t->rw_holds[i];
+    if (h->rwlock == rw) {
+      list_remove (&h->elem);
+      h->rwlock = NULL;
+      return;
+    }
+  }
+}
+
+/* Returns the highest priority among threads waiting on RW, or
+   PRI_MIN - 1 if there are none.  Interrupts must be off. */
+static int
+rwlock_max_waiter (struct rwlock *rw)
+{
+  struct list *lists[2] = { &rw->read_waiters, &rw->write_waiters };
+  int max = PRI_MIN - 1;
+
+  for (int i = 0; i < 2; i++) {
+    struct list_elem *e;
+    for (e = list_begin (lists[i]); e != list_end (lists[i]); e = list_next (e)) {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (t->priority > max)
+        max = t->priority;
+    }
+  }
+  return max;
+}
+
+/* Raises every holder of RW to at least PRIORITY, following each
+   holder that is itself waiting on a lock or rwlock, down to a
+   nesting DEPTH of 8.  Interrupts must be off. */
+static void
+rwlock_donate (struct rwlock *rw, int priority, int depth)
+{
+  struct list_elem *e;
+
+  if (thread_mlfqs || depth >= 8)
+    return;
+
+  for (e = list_begin (&rw->holds); e != list_end (&rw->holds); e = list_next (e)) {
+    struct thread *t = list_entry (e, struct rw_hold, elem)->thread;
+    int d;
+
+    if (t->priority >= priority)
+      continue;
+    thread_update_priority (t, priority);
+    for (d = depth + 1; d < 8 && t->wait_on_lock != NULL; d++) {
+      t = t->wait_on_lock->holder;
+      if (t == NULL || t->priority >= priority)
+        break;
+      thread_update_priority (t, priority);
+    }
+    if (d < 8 && t != NULL && t->wait_on_lock == NULL && t->wait_on_rwlock != NULL)
+      rwlock_donate (t->wait_on_rwlock, priority, d + 1);
+  }
+}
+
+/* Blocks the running thread on LIST of RW until a releasing
+   thread hands RW over to it.  Interrupts must be off. */
+static void
+rwlock_wait (struct rwlock *rw, struct list *list)
+{
+  struct thread *cur = thread_current ();
+
+  cur->wait_on_rwlock = rw;
+  rwlock_donate (rw, cur->priority, 0);
+  list_push_back (list, &cur->elem);
+  thread_block ();
+  cur->wait_on_rwlock = NULL;
+}
+
+/* Hands RW, which nobody holds any more, to its waiters: the
+   highest-priority writer if there is one, otherwise every
+   waiting reader.  Interrupts must be off. */
+static void
+rwlock_hand_off (struct rwlock *rw)
+{
+  ASSERT (rw->readers == 0 && rw->writer == NULL);
+
+  if (!list_empty (&rw->write_waiters)) {
+    /* cmp_thread_priority() sorts highest first, so the "minimum"
+       is the highest-priority writer. */
+    struct list_elem *e = list_min (&rw->write_waiters, cmp_thread_priority, NULL);
+    struct thread *t = list_entry (e, struct thread, elem);
+
+    list_remove (e);
+    rw->writer = t;
+    rwlock_add_hold (rw, t);
+    thread_unblock (t);
+  } else {
+    while (!list_empty (&rw->read_waiters)) {
+      struct thread *t = list_entry (list_pop_front (&rw->read_waiters),
+                                     struct thread, elem);
+      rw->readers++;
+      rwlock_add_hold (rw, t);
+      thread_unblock (t);
+    }
+  }
+
+  /* The new holders inherit the donations of those still waiting. */
+  rwlock_donate (rw, rwlock_max_waiter (rw), 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.  The current thread must not already hold RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_read_acquire (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (rw->writer != NULL || !list_empty (&rw->write_waiters))
+    rwlock_wait (rw, &rw->read_waiters);
+  else {
+    rw->readers++;
+    rwlock_add_hold (rw, thread_current ());
+  }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_read_release (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers > 0);
+
+  old_level = intr_disable ();
+  rwlock_remove_hold (rw, thread_current ());
+  if (--rw->readers == 0)
+    rwlock_hand_off (rw);
+  intr_set_level (old_level);
+
+  if (!thread_mlfqs)
+    refresh_priority ();
+  thread_test_preemption ();
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  The current thread must not already hold RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_write_acquire (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  old_level = intr_disable ();
+  if (rw->writer != NULL || rw->readers > 0)
+    rwlock_wait (rw, &rw->write_waiters);
+  else {
+    rw->writer = thread_current ();
+    rwlock_add_hold (rw, rw->writer);
+  }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_write_release (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer == thread_current ());
+
+  old_level = intr_disable ();
+  rwlock_remove_hold (rw, rw->writer);
+  rw->writer = NULL;
+  rwlock_hand_off (rw);
+  intr_set_level (old_level);
+
+  if (!thread_mlfqs)
+    refresh_priority ();
+  thread_test_preemption ();
+}
+
+/* Initializes spin lock LOCK.  A spin lock protects short
+   critical sections by keeping interrupts off while it is held,
+   so it may be used in an interrupt handler.  Never sleep while
+   holding one.  Only the bootstrap processor runs, so nothing
+   ever spins; the lock only catches recursive acquisition. */
+void spin_init(struct spinlock *lock) {
+    ASSERT(lock != NULL);
+    lock->locked = 0;
+    lock->old_level = INTR_OFF;
+}
+
+/* Disables interrupts and acquires LOCK. */
+void spin_lock(struct spinlock *lock) {
+    enum intr_level old_level;
+
+    ASSERT(lock != NULL);
+
+    old_level = intr_disable();
+    ASSERT(!lock->locked);
+    lock->locked = 1;
+    lock->old_level = old_level;
+}
+
+/* Releases LOCK and restores the interrupt level that was in
+   effect when it was acquired. */
+void spin_unlock(struct spinlock *lock) {
+    enum intr_level old_level;
+
+    ASSERT(lock != NULL);
+    ASSERT(lock->locked);
+
+    old_level = lock->old_level;
+    lock->locked = 0;
+    intr_set_level(old_level);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem {
     struct list_elem elem;      /* List element. */
@@ -13,6 +13,7 @@
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -26,10 +27,29 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-static struct list sleep_list;
+/* A run queue: lists of processes in THREAD_READY state, that
+   is, processes that are ready to run but not actually running.
+   There is one FIFO list per priority level, and bit N of `mask'
+   is set iff queues[N] is not empty, so the highest-priority
+   ready thread is found with a single bit scan.  Protected by
+   disabling interrupts. */
+struct runqueue {
+    struct list queues[PRI_MAX + 1]; /* Ready threads, by priority. */
+    uint64_t mask;                   /* Non-empty queues. */
+    size_t cnt;                      /* # of threads in the queues. */
+};
+
+/* Threads that are ready to run.  Pintos starts only the
+   bootstrap processor, so there is a single run queue. */
+static struct runqueue ready_queue;
+
+/* Threads blocked in thread_sleep(), kept as a binary min-heap
+   ordered by wakeup_tick, so the timer interrupt only touches
+   threads whose deadline has passed.  The array is grown by
+   thread_sleep(), never from interrupt context. */
+static struct thread **sleep_heap;
+static size_t sleep_cnt;   /* # of threads in sleep_heap. */
+static size_t sleep_pages; /* # of pages backing sleep_heap. */
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -40,6 +60,10 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* List of all processes.  Processes are added to this list when
+   they are created and removed when they exit. */
+static struct list all_list;
+
 /* Thread destruction requests */
 static struct list destruction_req;
 
@@ -52,11 +76,19 @@ static long long user_ticks;   /* # of timer ticks in user programs. */
 #define TIME_SLICE 4          /* # of timer ticks to give each thread. */
 static unsigned thread_ticks; /* # of timer ticks since last yield. */
 
+/* MLFQS. */
+#define NICE_MIN -20          /* Lowest niceness. */
+#define NICE_MAX 20           /* Highest niceness. */
+static fixed_t load_avg;      /* System load average. */
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
-int64_t next_tick_to_awake = INT64_MAX;
+
+/* Earliest wakeup_tick among the sleeping threads, or INT64_MAX
+   if no thread is sleeping. */
+static int64_t next_tick_to_awake = INT64_MAX;
 
 static void kernel_thread(thread_func *, void *aux);
 
@@ -66,6 +98,18 @@ static void init_thread(struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule(void);
 static tid_t allocate_tid(void);
+static void runqueue_init(struct runqueue *);
+static void runqueue_push(struct runqueue *, struct thread *);
+static void runqueue_remove(struct runqueue *, struct thread *);
+static struct thread *runqueue_pop(struct runqueue *);
+static int runqueue_max_priority(struct runqueue *);
+static void mlfqs_tick(struct thread *);
+static void mlfqs_update_all(void);
+static void mlfqs_update_priority(struct thread *);
+static bool sleep_heap_grow(void);
+static void sleep_heap_push(struct thread *);
+static struct thread *sleep_heap_pop(void);
+static void update_next_tick_to_awake(void);
 bool cmp_thread_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
 struct lock filesys_lock;
 /* Returns true if T appears to point to a valid thread. */
@@ -108,9 +152,9 @@ void thread_init(void)
 
     /* Init the globla thread context */
     lock_init(&tid_lock);
-    list_init(&ready_list);
-    list_init(&sleep_list);
+    runqueue_init(&ready_queue);
     list_init(&destruction_req);
+    list_init(&all_list);
     lock_init(&filesys_lock);
 
     /* Set up a thread structure for the running thread. */
@@ -118,6 +162,9 @@ void thread_init(void)
     init_thread(initial_thread, "main", PRI_DEFAULT);
     initial_thread->status = THREAD_RUNNING;
     initial_thread->tid = allocate_tid();
+    list_push_back(&all_list, &initial_thread->allelem);
+    if (thread_mlfqs)
+        mlfqs_update_priority(initial_thread);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -152,6 +199,9 @@ void thread_tick(void)
     else
         kernel_ticks++;
 
+    if (thread_mlfqs)
+        mlfqs_tick(t);
+
     /* Enforce preemption. */
     if (++thread_ticks >= TIME_SLICE)
         intr_yield_on_return();
@@ -182,6 +232,7 @@ tid_t thread_create(const char *name, int priority, thread_func *function, void
 {
     struct thread *t;
     tid_t tid;
+    enum intr_level old_level;
 
     ASSERT(function != NULL);
 
@@ -194,6 +245,15 @@ tid_t thread_create(const char *name, int priority, thread_func *function, void
     init_thread(t, name, priority);
     tid = t->tid = allocate_tid();
 
+    /* Under the MLFQS a new thread inherits its parent's niceness
+       and recent_cpu, and the priority argument is ignored. */
+    if (thread_mlfqs && function != idle)
+    {
+        t->nice = thread_current()->nice;
+        t->recent_cpu = thread_current()->recent_cpu;
+        mlfqs_update_priority(t);
+    }
+
     /* Call the kernel_thread if it scheduled.
      * Note) rdi is 1st argument, and rsi is 2nd argument. */
     t->tf.rip = (uintptr_t)kernel_thread;
@@ -211,17 +271,22 @@ tid_t thread_create(const char *name, int priority, thread_func *function, void
 	if (t->fdt == NULL)
 		return TID_ERROR;
 
+    old_level = intr_disable();
+    list_push_back(&all_list, &t->allelem);
+    intr_set_level(old_level);
+
     /* Add to run queue. */
     thread_unblock(t);
     thread_test_preemption();
 
     return tid;
 }
+
+/* Yields the CPU if a ready thread has a higher priority than
+   the running one. */
 void thread_test_preemption(void)
 {
-    if (!intr_context() && !list_empty(&ready_list) &&
-        thread_current()->priority <
-            list_entry(list_front(&ready_list), struct thread, elem)->priority)
+    if (!intr_context() && thread_current()->priority < runqueue_max_priority(&ready_queue))
         thread_yield();
 }
 /* Puts the current thread to sleep.  It will not be scheduled
@@ -254,8 +319,7 @@ void thread_unblock(struct thread *t)
 
     old_level = intr_disable();
     ASSERT(t->status == THREAD_BLOCKED);
-    // list_push_back (&ready_list, &t->elem);
-    list_insert_ordered(&ready_list, &t->elem, cmp_thread_priority, 0);
+    runqueue_push(&ready_queue, t);
     t->status = THREAD_READY;
     intr_set_level(old_level);
 }
@@ -303,6 +367,7 @@ void thread_exit(void)
     /* Just set our status to dying and schedule another process.
        We will be destroyed during the call to schedule_tail(). */
     intr_disable();
+    list_remove(&thread_current()->allelem);
     do_schedule(THREAD_DYING);
     NOT_REACHED();
 }
@@ -318,8 +383,7 @@ void thread_yield(void)
 
     old_level = intr_disable();
     if (cur != idle_thread)
-        // list_push_back (&ready_list, &cur->elem);
-        list_insert_ordered(&ready_list, &cur->elem, cmp_thread_priority, 0);
+        runqueue_push(&ready_queue, cur);
     cur->status = THREAD_READY;
     schedule();
     intr_set_level(old_level);
@@ -329,94 +393,320 @@ bool cmp_thread_priority(const struct list_elem *a, const struct list_elem *b, v
     return list_entry(a, struct thread, elem)->priority > list_entry(b, struct thread, elem)->priority;
 }
 
+/* Blocks the current thread until the timer reaches tick TICKS. */
 void thread_sleep(int64_t ticks)
 {
     struct thread *curr = thread_current();
     enum intr_level old_level;
 
-    old_level = intr_disable();
-    if (curr != idle_thread)
+    ASSERT(!intr_context());
+
+    if (curr == idle_thread)
+        return;
+
+    /* Make sure the heap has a free slot with interrupts off.
+       palloc never sleeps, since its pools are guarded by spin
+       locks, but growing the heap allocates and frees pages, so
+       it runs with interrupts on to keep that work out of the
+       timer interrupt's way.  sleep_heap_grow() turns them off
+       only to copy and swap the arrays. */
+    for (;;)
     {
-        curr->wakeup_tick = ticks;
-        list_push_back(&sleep_list, &curr->elem);
-        thread_block();
-        update_next_tick_to_awake(ticks);
+        old_level = intr_disable();
+        if (sleep_cnt < sleep_pages * PGSIZE / sizeof *sleep_heap)
+            break;
+        intr_set_level(old_level);
+
+        if (!sleep_heap_grow())
+        {
+            /* No memory for the heap: fall back to polling. */
+            while (timer_ticks() < ticks)
+                thread_yield();
+            return;
+        }
     }
 
+    curr->wakeup_tick = ticks;
+    sleep_heap_push(curr);
+    update_next_tick_to_awake();
+    thread_block();
+
     intr_set_level(old_level);
 }
 
+/* Wakes up every sleeping thread whose wakeup tick is at or
+   before TICKS.  Called from the timer interrupt; returns
+   immediately on ticks with nothing due. */
 void thread_awake(int64_t ticks)
 {
-    struct list_elem *e = list_begin(&sleep_list);
-    while (e != list_end(&sleep_list))
+    if (ticks < next_tick_to_awake)
+        return;
+
+    while (sleep_cnt > 0 && sleep_heap[0]->wakeup_tick <= ticks)
+        thread_unblock(sleep_heap_pop());
+    update_next_tick_to_awake();
+}
+
+/* Recomputes next_tick_to_awake from the top of the sleep heap.
+   Must be called with interrupts off. */
+static void update_next_tick_to_awake(void)
+{
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    next_tick_to_awake = sleep_cnt > 0 ? sleep_heap[0]->wakeup_tick : INT64_MAX;
+}
+
+/* Doubles the capacity of the sleep heap.  Returns false if
+   memory is not available. */
+static bool sleep_heap_grow(void)
+{
+    size_t new_pages = sleep_pages > 0 ? sleep_pages * 2 : 1;
+    struct thread **new_heap, **old_heap = NULL;
+    size_t old_pages = 0;
+    enum intr_level old_level;
+
+    new_heap = palloc_get_multiple(0, new_pages);
+    if (new_heap == NULL)
+        return false;
+
+    old_level = intr_disable();
+    if (sleep_pages < new_pages)
+    {
+        memcpy(new_heap, sleep_heap, sleep_cnt * sizeof *sleep_heap);
+        old_heap = sleep_heap;
+        old_pages = sleep_pages;
+        sleep_heap = new_heap;
+        sleep_pages = new_pages;
+    }
+    else
+    {
+        /* Somebody else grew it in the meantime. */
+        old_heap = new_heap;
+        old_pages = new_pages;
+    }
+    intr_set_level(old_level);
+
+    palloc_free_multiple(old_heap, old_pages);
+    return true;
+}
+
+/* Adds T to the sleep heap, which must have room for it.
+   Must be called with interrupts off. */
+static void sleep_heap_push(struct thread *t)
+{
+    size_t i = sleep_cnt++;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    while (i > 0)
     {
-        struct thread *t = list_entry(e, struct thread, elem);
-        if (t->wakeup_tick <= ticks)
-        {
-            e = list_remove(e);
-            thread_unblock(t);
-        }
-        else
-            e = list_next(e);
+        size_t parent = (i - 1) / 2;
+        if (sleep_heap[parent]->wakeup_tick <= t->wakeup_tick)
+            break;
+        sleep_heap[i] = sleep_heap[parent];
+        i = parent;
     }
+    sleep_heap[i] = t;
 }
 
-void update_next_tick_to_awake(int64_t ticks)
+/* Removes and returns the thread with the earliest wakeup tick.
+   Must be called with interrupts off. */
+static struct thread *sleep_heap_pop(void)
 {
-    next_tick_to_awake = (ticks < next_tick_to_awake) ? ticks : next_tick_to_awake;
+    struct thread *top, *last;
+    size_t i = 0;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+    ASSERT(sleep_cnt > 0);
+
+    top = sleep_heap[0];
+    last = sleep_heap[--sleep_cnt];
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= sleep_cnt)
+            break;
+        if (child + 1 < sleep_cnt && sleep_heap[child + 1]->wakeup_tick < sleep_heap[child]->wakeup_tick)
+            child++;
+        if (last->wakeup_tick <= sleep_heap[child]->wakeup_tick)
+            break;
+        sleep_heap[i] = sleep_heap[child];
+        i = child;
+    }
+    if (sleep_cnt > 0)
+        sleep_heap[i] = last;
+    return top;
 }
 
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority)
 {
+    /* The MLFQS computes priorities by itself. */
+    if (thread_mlfqs)
+        return;
+
     thread_current()->init_priority = new_priority;
     refresh_priority();
     thread_test_preemption();
 }
 
+/* Sets T's effective priority to PRIORITY.  If T is waiting in
+   the ready queue, it is moved to the queue of its new priority
+   so that the scheduler sees the change. */
+void thread_update_priority(struct thread *t, int priority)
+{
+    enum intr_level old_level;
+
+    ASSERT(is_thread(t));
+    ASSERT(PRI_MIN <= priority && priority <= PRI_MAX);
+
+    old_level = intr_disable();
+    if (t->status == THREAD_READY)
+    {
+        runqueue_remove(&ready_queue, t);
+        t->priority = priority;
+        runqueue_push(&ready_queue, t);
+    }
+    else
+        t->priority = priority;
+    intr_set_level(old_level);
+}
+
+/* Returns the number of CPUs the scheduler runs threads on.
+   Only the bootstrap processor is started, so this is 1. */
+int cpu_count(void)
+{
+    return 1;
+}
+
+/* Returns the index of the CPU executing the caller, for
+   indexing per-CPU data. */
+int cpu_id(void)
+{
+    return 0;
+}
+
 /* Returns the current thread's priority. */
 int thread_get_priority(void)
 {
     return thread_current()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED)
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest. */
+void thread_set_nice(int nice)
 {
-    /* TODO: Your implementation goes here */
+    struct thread *cur = thread_current();
+
+    ASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+
+    cur->nice = nice;
+    if (thread_mlfqs)
+    {
+        mlfqs_update_priority(cur);
+        thread_test_preemption();
+    }
 }
 
 /* Returns the current thread's nice value. */
 int thread_get_nice(void)
 {
-    /* TODO: Your implementation goes here */
-    return 0;
+    return thread_current()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int thread_get_load_avg(void)
 {
-    /* TODO: Your implementation goes here */
-    return 0;
+    enum intr_level old_level = intr_disable();
+    int load = fp_round(fp_mul_int(load_avg, 100));
+    intr_set_level(old_level);
+    return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int thread_get_recent_cpu(void)
 {
-    /* TODO: Your implementation goes here */
-    return 0;
+    enum intr_level old_level = intr_disable();
+    int recent = fp_round(fp_mul_int(thread_current()->recent_cpu, 100));
+    intr_set_level(old_level);
+    return recent;
+}
+
+/* MLFQS bookkeeping for timer tick, T being the running thread.
+   Between the once-per-second updates only the running thread's
+   recent_cpu changes, so only its priority has to be recomputed
+   on every fourth tick; the other threads' priorities cannot
+   have moved.  Everything is recomputed once per second. */
+static void mlfqs_tick(struct thread *t)
+{
+    int64_t ticks = timer_ticks();
+    bool idle = t == idle_thread;
+
+    if (!idle)
+        t->recent_cpu = fp_add_int(t->recent_cpu, 1);
+
+    if (ticks % TIMER_FREQ == 0)
+        mlfqs_update_all();
+    else if (ticks % TIME_SLICE == 0 && !idle)
+        mlfqs_update_priority(t);
+
+    if (!idle && t->priority < runqueue_max_priority(&ready_queue))
+        intr_yield_on_return();
+}
+
+/* Recomputes the load average, and then recent_cpu and priority
+   for every thread.  Called once per second. */
+static void mlfqs_update_all(void)
+{
+    int ready_threads = ready_queue.cnt;
+    fixed_t coef;
+    struct list_elem *e;
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    if (thread_current() != idle_thread)
+        ready_threads++;
+
+    /* load_avg = (59/60) * load_avg + (1/60) * ready_threads. */
+    load_avg = fp_add(fp_div_int(fp_mul_int(load_avg, 59), 60), fp_div_int(fp_from_int(ready_threads), 60));
+
+    /* recent_cpu = (2*load_avg) / (2*load_avg + 1) * recent_cpu + nice. */
+    coef = fp_div(fp_mul_int(load_avg, 2), fp_add_int(fp_mul_int(load_avg, 2), 1));
+    for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e))
+    {
+        struct thread *t = list_entry(e, struct thread, allelem);
+        if (t == idle_thread)
+            continue;
+        t->recent_cpu = fp_add_int(fp_mul(coef, t->recent_cpu), t->nice);
+        mlfqs_update_priority(t);
+    }
+}
+
+/* Sets T's priority to PRI_MAX - (recent_cpu / 4) - (nice * 2),
+   clamped to the valid range.  A ready thread moves to the run
+   queue of its new priority. */
+static void mlfqs_update_priority(struct thread *t)
+{
+    int priority = PRI_MAX - fp_round(fp_div_int(t->recent_cpu, 4)) - t->nice * 2;
+
+    if (priority < PRI_MIN)
+        priority = PRI_MIN;
+    else if (priority > PRI_MAX)
+        priority = PRI_MAX;
+
+    t->init_priority = priority;
+    thread_update_priority(t, priority);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   point it initializes idle_thread, "up"s the semaphore
+   passed to it to enable thread_start() to continue, and
+   immediately blocks.  After that, the idle thread never appears
+   in the ready list.  It is returned by next_thread_to_run() as
+   a special case when the ready list is empty. */
 static void idle(void *idle_started_ UNUSED)
 {
     struct semaphore *idle_started = idle_started_;
@@ -430,6 +720,23 @@ static void idle(void *idle_started_ UNUSED)
         intr_disable();
         thread_block();
 
+        /* Nothing to do anywhere: top up palloc's pre-zeroed
+           pages, one page per pass so that a wakeup gets the CPU
+           back quickly, before we halt. */
+        intr_enable();
+        if (palloc_zero_idle())
+            continue;
+        intr_disable();
+
+        /* An interrupt may have readied a thread while interrupts
+           were on above; halting now would leave it waiting for
+           the next tick. */
+        if (ready_queue.cnt > 0)
+        {
+            intr_enable();
+            continue;
+        }
+
         /* Re-enable interrupts and wait for the next one.
 
            The `sti' instruction disables interrupts until the
@@ -473,6 +780,7 @@ static void init_thread(struct thread *t, const char *name, int priority)
     /* for the donation test */
     t->init_priority = priority; // save orginal priority
     t->wait_on_lock = NULL;
+    t->wait_on_rwlock = NULL;
     list_init(&t->donations);
     t->next_fd = 3;
 
@@ -489,10 +797,64 @@ static void init_thread(struct thread *t, const char *name, int priority)
    idle_thread. */
 static struct thread *next_thread_to_run(void)
 {
-    if (list_empty(&ready_list))
-        return idle_thread;
-    else
-        return list_entry(list_pop_front(&ready_list), struct thread, elem);
+    struct thread *t = runqueue_pop(&ready_queue);
+
+    return t != NULL ? t : idle_thread;
+}
+
+/* Initializes RQ as an empty run queue. */
+static void runqueue_init(struct runqueue *rq)
+{
+    for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+        list_init(&rq->queues[pri]);
+    rq->mask = 0;
+    rq->cnt = 0;
+}
+
+/* Appends T to the tail of RQ's queue for T's priority. */
+static void runqueue_push(struct runqueue *rq, struct thread *t)
+{
+    list_push_back(&rq->queues[t->priority], &t->elem);
+    rq->mask |= 1ULL << t->priority;
+    rq->cnt++;
+}
+
+/* Removes T from RQ's queue for T's priority. */
+static void runqueue_remove(struct runqueue *rq, struct thread *t)
+{
+    list_remove(&t->elem);
+    if (list_empty(&rq->queues[t->priority]))
+        rq->mask &= ~(1ULL << t->priority);
+    rq->cnt--;
+}
+
+/* Removes and returns the first thread of the highest-priority
+   non-empty queue in RQ, or a null pointer if RQ is empty. */
+static struct thread *runqueue_pop(struct runqueue *rq)
+{
+    struct thread *t = NULL;
+    int pri;
+
+    if (rq->mask != 0)
+    {
+        pri = 63 - __builtin_clzll(rq->mask);
+        t = list_entry(list_pop_front(&rq->queues[pri]), struct thread, elem);
+        if (list_empty(&rq->queues[pri]))
+            rq->mask &= ~(1ULL << pri);
+        rq->cnt--;
+    }
+    return t;
+}
+
+/* Returns the highest priority among the threads in RQ, or -1 if
+   RQ is empty. */
+static int runqueue_max_priority(struct runqueue *rq)
+{
+    uint64_t mask = rq->mask;
+
+    if (mask == 0)
+        return -1;
+    return 63 - __builtin_clzll(mask);
 }
 
 /* Use iretq to launch the thread */
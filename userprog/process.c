@@ -15,6 +15,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
@@ -37,8 +38,10 @@ void argument_stack(char **argv, int argc, struct intr_frame *if_);
 static void process_init(void) {
     struct thread *current = thread_current();
 }
+/* Where lazy_load_segment() finds a page of the running
+ * executable.  The file is the process's own `running', so that
+ * a forked child's copy does not depend on its parent's. */
 struct aux_container {
-    struct file *file;
     off_t offset;
     uint32_t read_bytes;
     uint32_t zero_bytes;
@@ -195,6 +198,11 @@ static void __do_fork(void *aux) {
         current->fdt[i] = file;
     }
     current->next_fd = parent->next_fd;
+    if (parent->running != NULL) {
+        current->running = file_duplicate(parent->running);
+        if (current->running == NULL)
+            goto error;
+    }
 
     // 로드가 완료될 때까지 기다리고 있던 부모 대기 해제
     sema_up(&current->fork_sema);
@@ -333,10 +341,14 @@ void process_exit(void) {
     }
 
     palloc_free_multiple(curr->fdt, FDT_PAGES);
-    file_close(curr->running);  // 현재 실행 중인 파일도 닫는다.
 
     process_cleanup();
-    // hash_destroy(&curr->spt.spt_hash, NULL);  // todo 🚨
+    /* Only now that its pages are gone: the text cache keys shared
+     * text by the executable's inode. */
+    file_close(curr->running);  // 현재 실행 중인 파일도 닫는다.
+#ifdef VM
+    hash_destroy(&curr->spt.hash_page, NULL);
+#endif
 
     // 자식이 종료될 때까지 대기하고 있는 부모에게 signal을 보낸다.
     sema_up(&curr->wait_sema);
@@ -519,6 +531,7 @@ static bool load(const char *file_name, struct intr_frame *if_) {
         }
     }
 
+    file_close(t->running);
     t->running = file;
     file_deny_write(file);
 
@@ -682,29 +695,90 @@ static bool install_page(void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads a page of an ELF segment on its first fault.  AUX is the
+ * struct aux_container that load_segment() set up for the page. */
 static bool lazy_load_segment(struct page *page, void *aux) {
-    /* TODO: 파일에서 세그먼트를 로드합니다. */
-    /* TODO: VA 주소에 대한 최초의 페이지 폴트가 발생했을 때 이 함수가 호출됩니다. */
-    /* TODO: 이 함수를 호출할 때 VA가 사용 가능합니다. */
-    struct aux_container *lazy_aux_container = (struct aux_container *)aux;
-    // REVIEW palloc size 점검
-    struct frame *k_frame = palloc_get_page(PAL_USER);
-
-    return false;
+    struct aux_container *lazy = aux;
+    uint8_t *kva = page->frame->kva;
+    bool held = lock_held_by_current_thread(&filesys_lock);
+    bool success;
+
+    /* We may be faulting in on behalf of a system call that
+     * already holds the file system lock. */
+    if (!held)
+        lock_acquire(&filesys_lock);
+    success = file_read_at(thread_current()->running, kva, lazy->read_bytes, lazy->offset) == (int)lazy->read_bytes;
+    if (!held)
+        lock_release(&filesys_lock);
+    memset(kva + lazy->read_bytes, 0, lazy->zero_bytes);
+    free(lazy);
+    return success;
 }
 
-/* 파일에서 OFS 오프셋 위치부터 시작하는 세그먼트를 UPAGE 주소에 로드합니다.
- * 총 READ_BYTES + ZERO_BYTES 바이트의 가상 메모리가 다음과 같이 초기화됩니다:
+/* Registers the page at UPAGE of a segment, whose first
+ * READ_BYTES bytes are to be read from FILE at offset OFS, to be
+ * loaded on its first fault:
  *
- * - UPAGE에서 READ_BYTES 바이트는 OFS 오프셋에서 시작하여 FILE로부터 읽어야 합니다.
+ * - a page with nothing to read, such as most of a large BSS, is
+ *   a plain anonymous page, which starts out zeroed and may be
+ *   backed by a huge page;
  *
- * - UPAGE + READ_BYTES에서 ZERO_BYTES 바이트는 0으로 설정되어야 합니다.
+ * - a read-only page is file-backed, and shares its frame with
+ *   other processes running the same executable;
  *
- * 이 함수에 의해 초기화된 페이지는 WRITABLE이 true이면 사용자 프로세스에 의해
- * 쓰기 가능해야 하고, 그렇지 않으면 읽기 전용이어야 합니다.
+ * - any other page is anonymous, marked VM_SEGMENT and loaded by
+ *   lazy_load_segment().
  *
- * 성공하면 true를 반환하고, 메모리 할당 오류나 디스크 읽기 오류가 발생하면 false를 반환합니다.
- */
+ * Returns false if a memory allocation error occurs. */
+static bool alloc_segment_page(struct file *file, off_t ofs, uint8_t *upage, size_t read_bytes, bool writable) {
+    if (read_bytes == 0)
+        return vm_alloc_page(VM_ANON, upage, writable);
+
+    if (!writable) {
+        struct file_page *text = malloc(sizeof *text);
+        if (text == NULL)
+            return false;
+        text->inode = file_get_inode(file);
+        text->offset = ofs;
+        text->read_bytes = read_bytes;
+        text->region = NULL;
+        if (!vm_alloc_page_with_initializer(VM_FILE, upage, false, file_backed_load, text)) {
+            free(text);
+            return false;
+        }
+        return true;
+    }
+
+    struct aux_container *aux = malloc(sizeof *aux);
+    if (aux == NULL)
+        return false;
+    aux->offset = ofs;
+    aux->read_bytes = read_bytes;
+    aux->zero_bytes = PGSIZE - read_bytes;
+    if (!vm_alloc_page_with_initializer(VM_ANON | VM_SEGMENT, upage, writable, lazy_load_segment, aux)) {
+        free(aux);
+        return false;
+    }
+    return true;
+}
+
+/* Loads a segment starting at offset OFS in FILE at address
+ * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
+ * memory are initialized, as follows:
+ *
+ * - READ_BYTES bytes at UPAGE must be read from FILE
+ * starting at offset OFS.
+ *
+ * - ZERO_BYTES bytes at UPAGE + READ_BYTES must be zeroed.
+ *
+ * The pages initialized by this function must be writable by the
+ * user process if WRITABLE is true, read-only otherwise.
+ *
+ * Nothing is read here: each page is registered to be loaded on
+ * its first fault (see alloc_segment_page()).
+ *
+ * Return true if successful, false if a memory allocation error
+ * occurs. */
 static bool load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
     ASSERT((read_bytes + zero_bytes) % PGSIZE == 0);
     ASSERT(pg_ofs(upage) == 0);
@@ -717,18 +791,13 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t
         size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
         size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-        /* TODO: Set up aux to pass information to the lazy_load_segment. */
-        struct aux_container *aux_container;
-        aux_container->file = file;
-        aux_container->offset = ofs;
-        aux_container->read_bytes = read_bytes;
-        aux_container->zero_bytes = zero_bytes;
-        if (!vm_alloc_page_with_initializer(VM_ANON, upage, writable, lazy_load_segment, aux_container))
+        if (!alloc_segment_page(file, ofs, upage, page_read_bytes, writable))
             return false;
 
         /* Advance. */
         read_bytes -= page_read_bytes;
         zero_bytes -= page_zero_bytes;
+        ofs += page_read_bytes;
         upage += PGSIZE;
     }
     return true;
@@ -736,17 +805,15 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
 static bool setup_stack(struct intr_frame *if_) {
-    uint8_t *kpage;
-    bool success = false;
     void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
-    // FIXME 유저 페이지 어디
-    vm_alloc_page(VM_UNINIT, kpage, 1);
 
-    /* TODO: stack_bottom에 스택을 매핑하고 즉시 해당 페이지를 확보합니다.
-     * TODO: 성공했다면 rsp를 적절히 설정합니다.
-     * TODO: 해당 페이지를 스택 페이지로 표시해야 합니다.
-     */
-    return success;
+    /* Map the stack and claim it right away: we are about to push
+     * the arguments onto it.  It grows down from here on faults. */
+    if (!vm_alloc_page(VM_ANON | VM_STACK, stack_bottom, true) || !vm_claim_page(stack_bottom))
+        return false;
+    thread_current()->spt.stack_bottom = stack_bottom;
+    if_->rsp = USER_STACK;
+    return true;
 }
 #endif /* VM */
 
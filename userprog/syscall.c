@@ -10,6 +10,7 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -44,6 +45,7 @@ void exit(int status);
 void syscall_entry(void);
 void syscall_handler(struct intr_frame *);
 void check_address(void *addr);
+void check_writable_buffer(void *buffer, unsigned size);
 void halt(void);
 void exit(int status);
 bool create(const char *file, unsigned initial_size);
@@ -58,6 +60,12 @@ void close(int fd);
 tid_t fork(const char *thread_name);
 int exec(const char *cmd_line);
 int wait(int pid);
+int lockstat(char *buffer, unsigned size);
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+void munmap(void *addr);
+int madvise(void *addr, size_t length, int advice);
+#endif
 
 void syscall_init(void) {
     write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48 | ((uint64_t)SEL_KCSEG) << 32);
@@ -79,8 +87,46 @@ void check_address(void *addr) {
 	/* what if the user provides an invalid pointer, a pointer to kernel memory, 
 	 * or a block partially in one of those regions */
 	/* 잘못된 접근인 경우, 프로세스 종료 */
-	if (!is_user_vaddr(addr) || addr == NULL || pml4_get_page(t->pml4, addr) == NULL)
+	if (!is_user_vaddr(addr) || addr == NULL)
 		exit(-1);
+#ifdef VM
+	/* Pages that are not loaded yet are fine: touching them will
+	   fault them in. */
+	if (spt_find_page(&t->spt, addr) == NULL && !vm_claim_stack(addr))
+		exit(-1);
+#else
+	if (pml4_get_page(t->pml4, addr) == NULL)
+		exit(-1);
+#endif
+}
+
+/* Exits unless all of [BUFFER, BUFFER + SIZE) is user memory that
+   may be written.  Checking up front lets a system call fail here
+   rather than with the file system lock held when its copy faults
+   on a read-only page, and keeps a SIZE that wraps around from
+   cutting the check short. */
+void check_writable_buffer(void *buffer, unsigned size) {
+	uint64_t start = (uint64_t) buffer, end = start + size;
+	struct thread *t = thread_current();
+	uint64_t p;
+
+	if (size == 0)
+		return;
+	if (end < start || !is_user_vaddr(end - 1))
+		exit(-1);
+	for (p = (uint64_t) pg_round_down(start); p < end; p += PGSIZE) {
+#ifdef VM
+		struct page *page = spt_find_page(&t->spt, (void *) p);
+		if (page == NULL && vm_claim_stack((void *) p))
+			page = spt_find_page(&t->spt, (void *) p);
+		if (page == NULL || !page->writable)
+			exit(-1);
+#else
+		uint64_t *pte = pml4e_walk(t->pml4, p, 0);
+		if (pte == NULL || !(*pte & PTE_P) || !is_writable(pte))
+			exit(-1);
+#endif
+	}
 }
 void halt(void) {
     power_off();  // pintos 완전히 종료
@@ -110,8 +156,7 @@ int open(const char *file) {
         return -1;
     int fd = process_add_file(f);
     if (fd == -1)
-        // file_close(f);
-		free(f);
+        file_close(f);
     // lock_release(&filesys_lock);
     return fd;
 }
@@ -166,6 +211,7 @@ int read(int fd, void *buffer, unsigned size) // read 함수는 fd, size로 얼
 	// printf("fd 값 체크 : %d\n", fd);
 	// printf("size 값 체크 : %d\n", size);
 	check_address(buffer);
+	check_writable_buffer(buffer, size);
 	// printf("=========read 시작=============\n");
 	char *ptr = (char *)buffer;
 	int bytes_read = 0;
@@ -280,6 +326,48 @@ void close(int fd)
 	current->fdt[fd] = NULL;
 }
 
+/* Copies the kernel lock profile into BUFFER as text, truncated
+   to SIZE bytes including the null terminator.  Returns the
+   length of the text, or -1 if lock profiling is not built in. */
+int lockstat(char *buffer, unsigned size)
+{
+	if (size == 0)
+		return 0;
+	check_address(buffer);
+	check_writable_buffer(buffer, size);
+	return lock_stats_read(buffer, size);
+}
+
+#ifdef VM
+/* Maps LENGTH bytes of the file open as FD, from OFFSET on, at
+   ADDR.  The console cannot be mapped.  Returns ADDR, or
+   MAP_FAILED (a null pointer) on failure. */
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset)
+{
+	struct file *file;
+
+	if (fd == STDIN_FILENO || fd == STDOUT_FILENO)
+		return NULL;
+	file = process_get_file(fd);
+	if (file == NULL)
+		return NULL;
+	return do_mmap(addr, length, writable, file, offset);
+}
+
+/* Unmaps the mapping that mmap() returned ADDR for. */
+void munmap(void *addr)
+{
+	do_munmap(addr);
+}
+
+/* Tells the kernel how the LENGTH bytes at ADDR will be used, one
+   of the MADV_* hints.  Returns 0 if successful, -1 otherwise. */
+int madvise(void *addr, size_t length, int advice)
+{
+	return do_madvise(addr, length, advice);
+}
+#endif
+
 tid_t fork (const char *thread_name){
 	/* create new process, which is the clone of current process with the name THREAD_NAME*/
 	struct thread *curr = thread_current();
@@ -291,6 +379,11 @@ tid_t fork (const char *thread_name){
 void syscall_handler(struct intr_frame *f UNUSED) {
     // TODO: Your implementation goes here.
     int syscall_number = f->R.rax;  // system call number 가져오기
+#ifdef VM
+    /* A fault on a user address in the kernel needs this to tell
+       whether it is the stack growing. */
+    thread_current()->user_rsp = (void *)f->rsp;
+#endif
    switch (syscall_number)
 	{
 	case SYS_HALT:
@@ -336,12 +429,21 @@ void syscall_handler(struct intr_frame *f UNUSED) {
 	case SYS_CLOSE:
 		close(f->R.rdi);
 		break;
-	// case SYS_MMAP:
-	// 	f->R.rax = mmap(f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
-	// 	break;
-	// case SYS_MUNMAP:
-	// 	munmap(f->R.rdi);
-	// 	break;
+	case SYS_LOCKSTAT:
+		f->R.rax = lockstat((char *) f->R.rdi, f->R.rsi);
+		break;
+#ifdef VM
+	case SYS_MMAP:
+		f->R.rax = (uint64_t) mmap((void *) f->R.rdi, f->R.rsi, f->R.rdx,
+									f->R.r10, f->R.r8);
+		break;
+	case SYS_MUNMAP:
+		munmap((void *) f->R.rdi);
+		break;
+	case SYS_MADVISE:
+		f->R.rax = madvise((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+		break;
+#endif
 	}
     // printf ("system call!\n");
     // thread_exit ();
@@ -1,13 +1,27 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
 #include "devices/disk.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space is the whole of disk 1:1, carved into page-sized
+   slots of SECTORS_PER_SLOT consecutive sectors.  A set bit in
+   swap_table marks a slot in use; swap_lock protects it.  The
+   disk itself does its own locking. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Slot number of a page that is not in swap. */
+#define NO_SLOT BITMAP_ERROR
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
 static bool anon_swap_in (struct page *page, void *kva);
 static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
+static struct bitmap *swap_table;
+static struct lock swap_lock;
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
@@ -20,33 +34,87 @@ static const struct page_operations anon_ops = {
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt = 0;
+
+	swap_disk = disk_get (1, 1);
+	if (swap_disk != NULL)
+		slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_table = bitmap_create (slot_cnt);
+	if (swap_table == NULL)
+		PANIC ("swap table creation failed");
+	lock_init (&swap_lock);
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
-
-	struct anon_page *anon_page = &page->anon;
+	page->anon.slot = NO_SLOT;
+	page->anon.segment = (type & VM_SEGMENT) != 0;
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot == NO_SLOT)
+		return false;
+	disk_read_multiple (swap_disk, anon_page->slot * SECTORS_PER_SLOT, kva,
+			SECTORS_PER_SLOT);
+
+	lock_acquire (&swap_lock);
+	bitmap_reset (swap_table, anon_page->slot);
+	lock_release (&swap_lock);
+	anon_page->slot = NO_SLOT;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1);
+}
+
+/* Writes the CNT resident anonymous PAGES to CNT consecutive swap
+   slots, so that the disk sees one sequential run of writes.
+   The caller unmaps the pages first and releases their frames
+   afterward.  Returns false, writing nothing, if there is no
+   run of CNT free slots. */
+bool
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+	size_t slot, i;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_table, 0, cnt, false);
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	for (i = 0; i < cnt; i++) {
+		struct page *page = pages[i];
+
+		ASSERT (page->operations == &anon_ops);
+		ASSERT (page->frame != NULL);
+		disk_write_multiple (swap_disk, (slot + i) * SECTORS_PER_SLOT,
+				page->frame->kva, SECTORS_PER_SLOT);
+		page->anon.slot = slot + i;
+	}
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	vm_free_frame (page);
+	if (anon_page->slot != NO_SLOT) {
+		lock_acquire (&swap_lock);
+		bitmap_reset (swap_table, anon_page->slot);
+		lock_release (&swap_lock);
+	}
 }
@@ -1,6 +1,14 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -21,38 +29,305 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
+	return true;
+}
+
+/* Acquires the file system lock unless the current thread holds
+   it already, as it does when we fault on behalf of a system call
+   that has it.  Returns what filesys_lock_exit() needs to know. */
+static bool
+filesys_lock_enter (void) {
+	bool held = lock_held_by_current_thread (&filesys_lock);
+
+	if (!held)
+		lock_acquire (&filesys_lock);
+	return held;
+}
+
+/* Undoes filesys_lock_enter(), which returned HELD. */
+static void
+filesys_lock_exit (bool held) {
+	if (!held)
+		lock_release (&filesys_lock);
+}
 
+/* Reads PAGE's contents from its file into KVA. */
+static bool
+file_page_read (struct page *page, void *kva) {
 	struct file_page *file_page = &page->file;
+	bool held = filesys_lock_enter ();
+	off_t n;
+
+	n = inode_read_at (file_page->inode, kva, file_page->read_bytes,
+			file_page->offset);
+	filesys_lock_exit (held);
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return n == (off_t) file_page->read_bytes;
+}
+
+/* Loads a file-backed page on its first fault.  AUX is the
+   struct file_page to load it from.  A page that was given a
+   frame already loaded by another process (see claim_page())
+   has nothing left to read. */
+bool
+file_backed_load (struct page *page, void *aux) {
+	page->file = *(struct file_page *) aux;
+	free (aux);
+	if (page->frame->ref_cnt > 1)
+		return true;
+	return file_page_read (page, page->frame->kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	return file_page_read (page, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  A clean
+   page can just be dropped and read again later; a dirty page of a
+   mapping is written back to its file first.
+
+   We are called with the frame lock held, which a system call
+   holding the file system lock may be waiting for, so we only
+   take the file system lock if it is free.  Otherwise the page
+   stays in memory and the caller evicts another. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	bool held;
+	off_t n;
+
+	if (!pml4_is_dirty (page->pml4, page->va))
+		return true;
+	if (file_page->region == NULL)
+		return false;
+
+	held = lock_held_by_current_thread (&filesys_lock);
+	if (!held && !lock_try_acquire (&filesys_lock))
+		return false;
+	n = file_write_at (file_page->region->file, page->frame->kva,
+			file_page->read_bytes, file_page->offset);
+	filesys_lock_exit (held);
+	return n == (off_t) file_page->read_bytes;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+   A mapping's dirty pages have been written back by then (see
+   do_munmap()). */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	vm_free_frame (page);
 }
 
-/* Do the mmap */
+/* Do the mmap.  Maps LENGTH bytes of FILE, from OFFSET on, at
+   ADDR in the current process, with each page loaded on its
+   first access.  The mapping has a handle of FILE of its own, so
+   it outlives the process's closing FILE.  Bytes of the last page
+   past the end of the file read as zeros and are never written
+   back.  Returns ADDR, or a null pointer if the mapping is
+   invalid or would overlap a page already mapped. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region;
+	off_t file_len;
+	size_t i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+	if ((uint64_t) addr + length < (uint64_t) addr
+			|| !is_user_vaddr ((uint8_t *) addr + length - 1))
+		return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	lock_acquire (&filesys_lock);
+	region->file = file_reopen (file);
+	file_len = region->file != NULL ? file_length (region->file) : 0;
+	lock_release (&filesys_lock);
+	if (file_len == 0)
+		goto fail;
+	region->addr = addr;
+	region->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	region->offset = offset;
+	region->advice = MADV_NORMAL;
+
+	for (i = 0; i < region->page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		struct file_page *aux = malloc (sizeof *aux);
+
+		if (aux == NULL)
+			goto fail_pages;
+		aux->inode = file_get_inode (region->file);
+		aux->offset = ofs;
+		aux->read_bytes = ofs < file_len ? file_len - ofs : 0;
+		if (aux->read_bytes > PGSIZE)
+			aux->read_bytes = PGSIZE;
+		aux->region = region;
+		if (!vm_alloc_page_with_initializer (VM_FILE,
+					(uint8_t *) addr + i * PGSIZE, writable,
+					file_backed_load, aux)) {
+			free (aux);
+			goto fail_pages;
+		}
+	}
+	list_push_back (&spt->mmaps, &region->elem);
+	return addr;
+
+ fail_pages:
+	while (i-- > 0)
+		spt_remove_page (spt,
+				spt_find_page (spt, (uint8_t *) addr + i * PGSIZE));
+ fail:
+	lock_acquire (&filesys_lock);
+	file_close (region->file);
+	lock_release (&filesys_lock);
+	free (region);
+	return NULL;
+}
+
+/* Returns the mapping in SPT that contains user address VA, or a
+   null pointer if there is none. */
+struct mmap_region *
+mmap_find (struct supplemental_page_table *spt, const void *va) {
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->mmaps); e != list_end (&spt->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		const uint8_t *start = region->addr;
+
+		if ((const uint8_t *) va >= start
+				&& (const uint8_t *) va < start + region->page_cnt * PGSIZE)
+			return region;
+	}
+	return NULL;
+}
+
+/* Pins PAGE, of a mapping, and returns true if it is in memory and
+   dirty, with bytes of the file to write back. */
+static bool
+pin_if_dirty (struct page *page) {
+	if (page->operations->type != VM_FILE || page->file.read_bytes == 0
+			|| !vm_pin_frame (page))
+		return false;
+	if (pml4_is_dirty (page->pml4, page->va))
+		return true;
+	vm_unpin_frame (page);
+	return false;
 }
 
-/* Do the munmap */
+/* Writes the CNT pinned dirty pages of REGION starting at page
+   FIRST, BYTES bytes in all, back to its file in one write, then
+   unpins them.  The bytes are read at their user addresses, which
+   are those of the current process. */
+static void
+write_back_run (struct supplemental_page_table *spt,
+		struct mmap_region *region, size_t first, size_t cnt, size_t bytes) {
+	uint8_t *va = (uint8_t *) region->addr + first * PGSIZE;
+	bool held = filesys_lock_enter ();
+	size_t i;
+
+	file_write_at (region->file, va, bytes, region->offset + first * PGSIZE);
+	filesys_lock_exit (held);
+	for (i = 0; i < cnt; i++)
+		vm_unpin_frame (spt_find_page (spt, va + i * PGSIZE));
+}
+
+/* Writes the dirty pages of REGION, a mapping of the current
+   process, back to its file.  Clean pages and pages that are not
+   in memory have nothing new to write.  Each run of consecutive
+   dirty pages goes out in one write, which the file system can
+   lay out and issue as a whole, instead of one write per page. */
+static void
+mmap_write_back (struct supplemental_page_table *spt,
+		struct mmap_region *region) {
+	size_t first = 0, cnt = 0, bytes = 0;
+	size_t i;
+
+	ASSERT (spt == &thread_current ()->spt);
+
+	for (i = 0; i <= region->page_cnt; i++) {
+		struct page *page = NULL;
+
+		if (i < region->page_cnt)
+			page = spt_find_page (spt, (uint8_t *) region->addr + i * PGSIZE);
+		if (page != NULL && pin_if_dirty (page)) {
+			if (cnt++ == 0) {
+				first = i;
+				bytes = 0;
+			}
+			bytes += page->file.read_bytes;
+			/* A partial page is the last with anything to write. */
+			if (page->file.read_bytes == PGSIZE)
+				continue;
+		}
+		if (cnt > 0)
+			write_back_run (spt, region, first, cnt, bytes);
+		cnt = 0;
+	}
+}
+
+/* Do the munmap.  Unmaps the mapping at ADDR, which must be the
+   address mmap() returned, writing its dirty pages back first. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region = mmap_find (spt, addr);
+	bool held;
+	size_t i;
+
+	if (region == NULL || region->addr != addr)
+		return;
+	mmap_write_back (spt, region);
+	for (i = 0; i < region->page_cnt; i++) {
+		struct page *page = spt_find_page (spt,
+				(uint8_t *) addr + i * PGSIZE);
+
+		/* A fork that failed half way may not have copied it. */
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	list_remove (&region->elem);
+	held = filesys_lock_enter ();
+	file_close (region->file);
+	filesys_lock_exit (held);
+	free (region);
+}
+
+/* Gives DST, the current process's table, a copy of each mapping
+   in SRC, with a handle of the file of its own.  The pages are
+   copied separately; see mmap_find(). */
+bool
+mmap_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct list_elem *e;
+
+	for (e = list_begin (&src->mmaps); e != list_end (&src->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		struct mmap_region *copy = malloc (sizeof *copy);
+
+		if (copy == NULL)
+			return false;
+		*copy = *region;
+		lock_acquire (&filesys_lock);
+		copy->file = file_reopen (region->file);
+		lock_release (&filesys_lock);
+		if (copy->file == NULL) {
+			free (copy);
+			return false;
+		}
+		list_push_back (&dst->mmaps, &copy->elem);
+	}
+	return true;
 }